@@ -0,0 +1,287 @@
+/* bench.c
+ * time each step of the EEPROM fix flow over many runs
+ *
+ * (C) 2015-2019 by Gwenhael Goavec-Merou <gwen@trabucayre.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <ftdi.h>
+#include "ftdi_i.h"
+#include "myftdi.h"
+#include "fix.h"
+#include "transport.h"
+#include "sim.h"
+
+struct bench {
+	int vendor_id;
+	int product_id;
+	const struct sim_config *sim;
+	int iterations;
+	int restore;
+	struct fix_config cfg;
+	unsigned char factory[FTDI_MAX_EEPROM_SIZE];
+	/* samples: iterations entries per phase, + total */
+	double *samples[FIX_PHASE_NR + 1];
+	unsigned long transfers;
+	double transfer_ms;
+	int failed;
+};
+
+static void usage(const char *name)
+{
+	printf("%s [-v vid] [-p pid] [--sim spec] [-N iterations] [-w window]"
+	       " [--compare] [--no-restore]\n", name);
+	printf("   -v default: 0x403\n");
+	printf("   -p default: 0x6010\n");
+	printf("   --sim simulated board, same spec as fixFT2232_ecp5evn\n");
+	printf("   -N number of runs (default: 20)\n");
+	printf("   -w max pending EEPROM transfers (default: 0, blocking)\n");
+	printf("   --compare run blocking then pipelined (-w or 32) transfers\n");
+	printf("   --no-restore keep fixed EEPROM between runs\n");
+}
+
+static int bench_open(struct bench *b, struct fix_dev *dev)
+{
+	if (b->sim)
+		return sim_dev_open(dev, b->sim, 0);
+	return usb_dev_open(dev, b->vendor_id, b->product_id, 0);
+}
+
+/* read factory content once, to restore it after each run */
+static int bench_save_factory(struct bench *b)
+{
+	struct fix_dev dev;
+	int ret;
+
+	if (bench_open(b, &dev) != 0)
+		return -1;
+	ret = dev.ops->read_eeprom(&dev, b->cfg.async_window);
+	if (ret == 0)
+		memcpy(b->factory, dev.ftdi->eeprom->buf, FTDI_MAX_EEPROM_SIZE);
+	else
+		printf("FTDI read EEPROM failed: %s\n",
+		       ftdi_get_error_string(dev.ftdi));
+	fix_dev_close(&dev);
+	return ret;
+}
+
+/* put factory content back so next run has something to write */
+static int bench_restore(struct bench *b)
+{
+	struct fix_dev dev;
+	unsigned char cur[FTDI_MAX_EEPROM_SIZE];
+	int ret;
+
+	if (bench_open(b, &dev) != 0)
+		return -1;
+	ret = dev.ops->read_eeprom(&dev, b->cfg.async_window);
+	if (ret == 0) {
+		memcpy(cur, dev.ftdi->eeprom->buf, FTDI_MAX_EEPROM_SIZE);
+		memcpy(dev.ftdi->eeprom->buf, b->factory, FTDI_MAX_EEPROM_SIZE);
+		dev.ftdi->eeprom->initialized_for_connected_device = 1;
+		ret = dev.ops->write_eeprom(&dev, cur, b->cfg.async_window,
+					    b->cfg.write_delay_us,
+					    b->cfg.write_retries);
+		if (ret > 0)
+			dev.ops->reset(&dev);
+	}
+	fix_dev_close(&dev);
+	return (ret < 0) ? ret : 0;
+}
+
+static int bench_one(struct bench *b, int it)
+{
+	struct fix_dev dev;
+	struct fix_result res;
+	double start;
+	int i, ret;
+
+	memset(&res, 0, sizeof(res));
+	start = fix_now_ms();
+	ret = bench_open(b, &dev);
+	res.phase_ms[FIX_PHASE_OPEN] = fix_now_ms() - start;
+	if (ret != 0)
+		return -1;
+	ret = fix_device(&dev, &b->cfg, &res);
+	fix_dev_close(&dev);
+	if (ret != 0)
+		return -1;
+
+	for (i = 0; i < FIX_PHASE_NR; i++)
+		b->samples[i][it] = res.phase_ms[i];
+	b->samples[FIX_PHASE_NR][it] = res.phase_ms[FIX_PHASE_OPEN] +
+				       res.elapsed_ms;
+	b->transfers += res.transfers;
+	b->transfer_ms += res.phase_ms[FIX_PHASE_READ] +
+			  res.phase_ms[FIX_PHASE_WRITE] +
+			  res.phase_ms[FIX_PHASE_VERIFY] +
+			  res.phase_ms[FIX_PHASE_RESET];
+
+	if (b->restore && res.status == FIX_UPDATED)
+		return bench_restore(b);
+	return 0;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double da = *(const double *)a, db = *(const double *)b;
+
+	return (da > db) - (da < db);
+}
+
+/* sort samples and return median */
+static double bench_report_line(const char *name, double *s, int n)
+{
+	double sum = 0;
+	int i, p99;
+
+	qsort(s, n, sizeof(double), cmp_double);
+	for (i = 0; i < n; i++)
+		sum += s[i];
+	p99 = (n * 99 + 99) / 100 - 1;
+	printf("%-8s %10.3f %10.3f %10.3f %10.3f\n", name, s[0], s[n / 2],
+	       s[p99], sum / n);
+	return s[n / 2];
+}
+
+/* run all iterations, return median total time or < 0 on error */
+static double bench_run(struct bench *b)
+{
+	double median = -1;
+	int i, it, done = 0;
+
+	for (i = 0; i <= FIX_PHASE_NR; i++) {
+		b->samples[i] = calloc(b->iterations, sizeof(double));
+		if (b->samples[i] == NULL)
+			goto out;
+	}
+	b->transfers = 0;
+	b->transfer_ms = 0;
+	b->failed = 0;
+
+	if (b->restore && bench_save_factory(b) != 0)
+		goto out;
+
+	for (it = 0; it < b->iterations; it++) {
+		if (bench_one(b, done) != 0)
+			b->failed++;
+		else
+			done++;
+	}
+
+	printf("\n%d run(s), %d failed, %s transfers (window %d)\n",
+	       b->iterations, b->failed,
+	       (b->cfg.async_window > 1) ? "pipelined" : "blocking",
+	       b->cfg.async_window);
+	if (done == 0)
+		goto out;
+
+	printf("%-8s %10s %10s %10s %10s  (ms)\n", "phase", "min", "median",
+	       "p99", "mean");
+	for (i = 0; i < FIX_PHASE_NR; i++)
+		bench_report_line(fix_phase_str(i), b->samples[i], done);
+	median = bench_report_line("total", b->samples[FIX_PHASE_NR], done);
+	printf("transfers: %.1f per run, %.0f per second\n",
+	       (double)b->transfers / done,
+	       (b->transfer_ms > 0) ? b->transfers * 1000.0 / b->transfer_ms : 0);
+
+out:
+	/* NULL again: --compare runs twice with the same bench */
+	for (i = 0; i <= FIX_PHASE_NR; i++) {
+		free(b->samples[i]);
+		b->samples[i] = NULL;
+	}
+	return median;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench b;
+	struct sim_config sim;
+	double sync_ms, async_ms;
+	int c, compare = 0;
+	static const struct option long_options[] = {
+		{"vid", required_argument, 0, 'v'},
+		{"pid", required_argument, 0, 'p'},
+		{"sim", required_argument, 0, 'S'},
+		{"iterations", required_argument, 0, 'N'},
+		{"window", required_argument, 0, 'w'},
+		{"compare", no_argument, 0, 'C'},
+		{"no-restore", no_argument, 0, 'r'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	memset(&b, 0, sizeof(b));
+	b.vendor_id = 0x403;
+	b.product_id = 0x6010;
+	b.iterations = 20;
+	b.restore = 1;
+	b.cfg.write_retries = 2;
+	b.cfg.verify_retries = 3;
+	b.cfg.verify_backoff_ms = 10;
+
+	while ((c = getopt_long(argc, argv, "v:p:N:w:h", long_options,
+				NULL)) != -1) {
+		switch (c) {
+		case 'v':
+			sscanf(optarg, "%x", &b.vendor_id);
+			break;
+		case 'p':
+			sscanf(optarg, "%x", &b.product_id);
+			break;
+		case 'S':
+			if (sim_parse(&sim, optarg) != 0)
+				return EXIT_FAILURE;
+			b.sim = &sim;
+			break;
+		case 'N':
+			b.iterations = atoi(optarg);
+			break;
+		case 'w':
+			b.cfg.async_window = atoi(optarg);
+			break;
+		case 'C':
+			compare = 1;
+			break;
+		case 'r':
+			b.restore = 0;
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (b.iterations < 1)
+		b.iterations = 1;
+
+	if (!compare)
+		return (bench_run(&b) < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+
+	if (b.cfg.async_window <= 1)
+		b.cfg.async_window = MY_FTDI_ASYNC_WINDOW;
+	c = b.cfg.async_window;
+	b.cfg.async_window = 0;
+	sync_ms = bench_run(&b);
+	b.cfg.async_window = c;
+	async_ms = bench_run(&b);
+	if (sync_ms < 0 || async_ms <= 0)
+		return EXIT_FAILURE;
+	printf("\nmedian run: blocking %.3f ms, pipelined %.3f ms, "
+	       "speedup x%.2f\n", sync_ms, async_ms, sync_ms / async_ms);
+	return EXIT_SUCCESS;
+}
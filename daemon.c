@@ -0,0 +1,213 @@
+/* daemon.c
+ * fix devices on hotplug, using a persistent libusb context
+ *
+ * (C) 2015-2019 by Gwenhael Goavec-Merou <gwen@trabucayre.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <ftdi.h>
+#include <libusb.h>
+#include "fix.h"
+#include "transport.h"
+#include "workq.h"
+#include "metrics.h"
+#include "daemon.h"
+
+struct daemon {
+	libusb_context *usb_ctx;	/* shared by all workers */
+	struct workq queue;		/* arrived libusb_device, referenced */
+	const struct fix_config *cfg;
+	pthread_mutex_t lock;		/* output and counters */
+	int fixed;
+	int failed;
+};
+
+static volatile sig_atomic_t daemon_stop;
+
+static void daemon_signal(int sig)
+{
+	(void)sig;
+	daemon_stop = 1;
+}
+
+/* called from libusb event handling: no I/O here, only queue the device */
+static int daemon_hotplug(libusb_context *ctx, libusb_device *udev,
+		libusb_hotplug_event event, void *user_data)
+{
+	struct daemon *d = user_data;
+
+	(void)ctx;
+	if (event != LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED)
+		return 0;
+	libusb_ref_device(udev);
+	if (workq_push(&d->queue, udev) != 0)
+		libusb_unref_device(udev);
+	return 0;
+}
+
+static void daemon_fix_one(struct daemon *d, struct ftdi_context *ftdi,
+		libusb_device *udev)
+{
+	struct fix_dev dev;
+	struct fix_result res;
+	double start = fix_now_ms();
+	int ret;
+
+	memset(&res, 0, sizeof(res));
+	res.status = FIX_FAILED;
+	fix_usb_path(udev, res.path, sizeof(res.path));
+
+	ret = usb_dev_open_device(&dev, ftdi, udev, d->cfg->passive);
+	res.phase_ms[FIX_PHASE_OPEN] = fix_now_ms() - start;
+	if (ret != 0) {
+		snprintf(res.msg, sizeof(res.msg), "open failed");
+		res.ret = ret;
+	} else {
+		fix_device(&dev, d->cfg, &res);
+		fix_dev_close(&dev);
+	}
+
+	pthread_mutex_lock(&d->lock);
+	if (res.status == FIX_FAILED)
+		d->failed++;
+	else if (res.status == FIX_UPDATED)
+		d->fixed++;
+	printf("%-16s %-20s %-18s %6d %10.1f  %s\n", res.path, res.serial,
+	       fix_status_str(res.status), res.words_written,
+	       res.elapsed_ms, res.msg);
+	fflush(stdout);
+	if (d->cfg->json) {
+		fix_result_json(d->cfg->json, &res);
+		fflush(d->cfg->json);
+	}
+	pthread_mutex_unlock(&d->lock);
+	metrics_record(d->cfg->metrics, &res);
+}
+
+static void daemon_unref(void *udev)
+{
+	libusb_unref_device(udev);
+}
+
+/* one ftdi context per worker, reused for every device it handles */
+static void *daemon_worker(void *arg)
+{
+	struct daemon *d = arg;
+	struct ftdi_context *ftdi;
+	libusb_device *udev;
+
+	if ((ftdi = usb_ftdi_new_shared(d->usb_ctx)) == NULL) {
+		printf("FTDI context allocation failed\n");
+		return NULL;
+	}
+	while ((udev = workq_pop(&d->queue)) != NULL) {
+		daemon_fix_one(d, ftdi, udev);
+		libusb_unref_device(udev);
+	}
+	usb_ftdi_free_shared(ftdi);
+	return NULL;
+}
+
+int daemon_run(int vendor_id, int product_id, int jobs,
+		const struct fix_config *cfg)
+{
+	struct daemon d;
+	libusb_hotplug_callback_handle handle;
+	struct sigaction sa;
+	struct timeval tv;
+	pthread_t *threads;
+	int ret, i;
+
+	memset(&d, 0, sizeof(d));
+	d.cfg = cfg;
+
+	if (libusb_init(&d.usb_ctx) < 0) {
+		printf("libusb init failed\n");
+		return -1;
+	}
+	if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+		printf("hotplug not supported on this platform\n");
+		libusb_exit(d.usb_ctx);
+		return -1;
+	}
+	if (workq_init(&d.queue) != 0) {
+		libusb_exit(d.usb_ctx);
+		return -1;
+	}
+	pthread_mutex_init(&d.lock, NULL);
+
+	if (jobs < 1)
+		jobs = 1;
+	threads = calloc(jobs, sizeof(pthread_t));
+	for (i = 0; threads && i < jobs; i++) {
+		if (pthread_create(&threads[i], NULL, daemon_worker, &d) != 0)
+			break;
+	}
+	jobs = i;
+	if (jobs == 0) {
+		printf("no worker thread\n");
+		ret = -1;
+		goto out;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = daemon_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	/* enumerate: already plugged devices are reported as arrived */
+	ret = libusb_hotplug_register_callback(d.usb_ctx,
+			LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED,
+			LIBUSB_HOTPLUG_ENUMERATE, vendor_id, product_id,
+			LIBUSB_HOTPLUG_MATCH_ANY, daemon_hotplug, &d, &handle);
+	if (ret != LIBUSB_SUCCESS) {
+		printf("hotplug register failed: %d\n", ret);
+		ret = -1;
+		goto stop;
+	}
+
+	printf("waiting for devices (%d worker(s)), ^C to stop\n", jobs);
+	printf("%-16s %-20s %-18s %6s %10s  %s\n", "path", "serial",
+	       "status", "words", "time(ms)", "error");
+	fflush(stdout);
+
+	while (!daemon_stop) {
+		tv.tv_sec = 0;
+		tv.tv_usec = 500000;
+		libusb_handle_events_timeout_completed(d.usb_ctx, &tv, NULL);
+	}
+	libusb_hotplug_deregister_callback(d.usb_ctx, handle);
+	ret = 0;
+
+stop:
+	workq_stop(&d.queue);
+	for (i = 0; i < jobs; i++)
+		pthread_join(threads[i], NULL);
+	if (ret == 0) {
+		printf("%d device(s) fixed, %d failed\n", d.fixed, d.failed);
+		ret = d.failed;
+	}
+out:
+	free(threads);
+	pthread_mutex_destroy(&d.lock);
+	/* arrived but never handled */
+	workq_destroy(&d.queue, daemon_unref);
+	libusb_exit(d.usb_ctx);
+	return ret;
+}
@@ -0,0 +1,13 @@
+#ifndef DAEMON_H_
+#define DAEMON_H_
+#include "fix.h"
+
+/* wait for vid:pid devices (already plugged ones included) and fix them
+ * as they arrive, with at most jobs devices handled at the same time.
+ * All devices share one libusb context kept for the daemon lifetime.
+ * run until SIGINT/SIGTERM, return the number of failed devices or -1
+ * when hotplug is not available
+ */
+int daemon_run(int vendor_id, int product_id, int jobs,
+		const struct fix_config *cfg);
+#endif
@@ -0,0 +1,178 @@
+/* devindex.c
+ * find USB devices by topology path or serial from sysfs, without
+ * opening them
+ *
+ * (C) 2015-2019 by Gwenhael Goavec-Merou <gwen@trabucayre.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include "devindex.h"
+
+#ifndef DEVINDEX_SYSFS
+#define DEVINDEX_SYSFS "/sys/bus/usb/devices"
+#endif
+
+/* first line of sysfs attribute, without newline */
+static int read_attr(const char *path, const char *name, char *buf, int len)
+{
+	char file[PATH_MAX];
+	FILE *fd;
+
+	snprintf(file, sizeof(file), DEVINDEX_SYSFS "/%s/%s", path, name);
+	if ((fd = fopen(file, "r")) == NULL)
+		return -1;
+	if (fgets(buf, len, fd) == NULL)
+		buf[0] = '\0';
+	fclose(fd);
+	buf[strcspn(buf, "\n")] = '\0';
+	return 0;
+}
+
+/* info from sysfs device directory path */
+static int read_device(const char *path, struct usb_devinfo *info)
+{
+	char buf[16];
+
+	memset(info, 0, sizeof(*info));
+	snprintf(info->path, sizeof(info->path), "%s", path);
+	if (read_attr(path, "busnum", buf, sizeof(buf)) != 0)
+		return 1;
+	info->bus = atoi(buf);
+	if (read_attr(path, "devnum", buf, sizeof(buf)) != 0)
+		return 1;
+	info->addr = atoi(buf);
+	if (read_attr(path, "idVendor", buf, sizeof(buf)) == 0)
+		info->vendor_id = strtol(buf, NULL, 16);
+	if (read_attr(path, "idProduct", buf, sizeof(buf)) == 0)
+		info->product_id = strtol(buf, NULL, 16);
+	/* serial is the string descriptor read by the kernel at enumeration */
+	read_attr(path, "serial", info->serial, sizeof(info->serial));
+	return 0;
+}
+
+/* device directories are bus-port[.port...]: skip root hubs (usbN) and
+ * interfaces (bus-port:config.interface)
+ */
+static int is_device_dir(const char *name)
+{
+	return name[0] >= '0' && name[0] <= '9' && strchr(name, '-') &&
+	       !strchr(name, ':');
+}
+
+int devindex_by_path(const char *path, struct usb_devinfo *info)
+{
+	struct dirent *de = NULL;
+	DIR *d;
+	int bus, addr;
+
+	if (is_device_dir(path))
+		return read_device(path, info);
+	if (sscanf(path, "%d:%d", &bus, &addr) != 2)
+		return 1;
+
+	/* bus:addr: topology path from sysfs when available */
+	if ((d = opendir(DEVINDEX_SYSFS)) != NULL) {
+		while ((de = readdir(d)) != NULL) {
+			if (is_device_dir(de->d_name) &&
+			    read_device(de->d_name, info) == 0 &&
+			    info->bus == bus && info->addr == addr)
+				break;
+		}
+		closedir(d);
+	}
+	if (de == NULL) {
+		memset(info, 0, sizeof(*info));
+		info->bus = bus;
+		info->addr = addr;
+		snprintf(info->path, sizeof(info->path), "%d:%d", bus, addr);
+	}
+	return 0;
+}
+
+/* cached entry still describes the device at its path */
+static int index_lookup(const char *index, const char *serial,
+		int vendor_id, int product_id, struct usb_devinfo *info)
+{
+	char s[64], path[32];
+	int vid, pid, ret = 1;
+	FILE *fd;
+
+	if ((fd = fopen(index, "r")) == NULL)
+		return 1;
+	while (ret && fscanf(fd, "%63s %31s %x %x", s, path, &vid,
+			     &pid) == 4) {
+		if (strcmp(s, serial) || vid != vendor_id || pid != product_id)
+			continue;
+		if (read_device(path, info) == 0 &&
+		    strcmp(info->serial, serial) == 0 &&
+		    info->vendor_id == vid && info->product_id == pid)
+			ret = 0;
+		break;
+	}
+	fclose(fd);
+	return ret;
+}
+
+int devindex_by_serial(const char *index, const char *serial, int vendor_id,
+		int product_id, struct usb_devinfo *info)
+{
+	struct usb_devinfo cur;
+	char tmp[PATH_MAX];
+	struct dirent *de;
+	FILE *fd = NULL;
+	DIR *d;
+	int ret = 1;
+
+	if (index && index_lookup(index, serial, vendor_id, product_id,
+				  info) == 0)
+		return 0;
+
+	/* stale or missing entry: scan sysfs and rebuild the index */
+	if ((d = opendir(DEVINDEX_SYSFS)) == NULL) {
+		printf("%s: %s\n", DEVINDEX_SYSFS, strerror(errno));
+		return -1;
+	}
+	if (index) {
+		snprintf(tmp, sizeof(tmp), "%s.tmp", index);
+		if ((fd = fopen(tmp, "w")) == NULL)
+			printf("%s: %s\n", tmp, strerror(errno));
+	}
+	while ((de = readdir(d)) != NULL) {
+		if (!is_device_dir(de->d_name) ||
+		    read_device(de->d_name, &cur) != 0 ||
+		    cur.vendor_id != vendor_id ||
+		    cur.product_id != product_id || cur.serial[0] == '\0')
+			continue;
+		/* serials with spaces can't be cached: always scanned */
+		if (fd && strpbrk(cur.serial, " \t") == NULL)
+			fprintf(fd, "%s %s %04x %04x\n", cur.serial, cur.path,
+				cur.vendor_id, cur.product_id);
+		if (ret && strcmp(cur.serial, serial) == 0) {
+			*info = cur;
+			ret = 0;
+		}
+	}
+	closedir(d);
+	if (fd && (fclose(fd) != 0 || rename(tmp, index) != 0)) {
+		printf("%s: %s\n", index, strerror(errno));
+		unlink(tmp);
+	}
+	return ret;
+}
@@ -0,0 +1,28 @@
+#ifndef DEVINDEX_H_
+#define DEVINDEX_H_
+
+/* serial -> path cache file name, in --state-dir */
+#define DEVINDEX_FILE "devices.index"
+
+/* USB device as seen by sysfs: found without opening it */
+struct usb_devinfo {
+	char path[32];		/* sysfs/topology path: bus-port[.port...] */
+	char serial[64];
+	int bus;
+	int addr;
+	int vendor_id;
+	int product_id;
+};
+
+/* path is a topology path (1-2.4) or bus:addr (3:12)
+ * return 0 when found, 1 when not found
+ */
+int devindex_by_path(const char *path, struct usb_devinfo *info);
+/* vid:pid device with this serial. index, when not NULL, is a file
+ * caching serial to path: an entry is checked against sysfs, the file is
+ * rebuilt from a sysfs scan when stale or missing
+ * return 0 when found, 1 when not found, -1 on error
+ */
+int devindex_by_serial(const char *index, const char *serial, int vendor_id,
+		int product_id, struct usb_devinfo *info);
+#endif
@@ -0,0 +1,863 @@
+/* fix.c
+ * FT2232 EEPROM fix flow for one device
+ *
+ * (C) 2015-2019 by Gwenhael Goavec-Merou <gwen@trabucayre.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <ftdi.h>
+#include <libusb.h>
+#include "ftdi_i.h"
+#include "myftdi.h"
+#include "myftdi_layout.h"
+#include "myftdi_image.h"
+#include "transport.h"
+#include "profile.h"
+#include "journal.h"
+#include "fix.h"
+
+double fix_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+int fix_usb_path(struct libusb_device *dev, char *buf, int len)
+{
+	uint8_t ports[8];
+	int nb, i, pos;
+
+	pos = snprintf(buf, len, "%d", libusb_get_bus_number(dev));
+	nb = libusb_get_port_numbers(dev, ports, sizeof(ports));
+	for (i = 0; i < nb && pos < len; i++)
+		pos += snprintf(buf + pos, len - pos, "%c%d",
+				(i == 0) ? '-' : '.', ports[i]);
+	return nb;
+}
+
+const char *fix_phase_str(int phase)
+{
+	static const char *names[FIX_PHASE_NR] = {
+		"open", "read", "decode", "patch", "build", "write", "verify",
+		"reset"
+	};
+
+	return (phase >= 0 && phase < FIX_PHASE_NR) ? names[phase] : "?";
+}
+
+/* account time since *t to phase and restart *t */
+static void fix_phase_end(struct fix_result *res, int phase, double *t)
+{
+	double now = fix_now_ms();
+
+	res->phase_ms[phase] += now - *t;
+	*t = now;
+}
+
+const char *fix_status_str(int status)
+{
+	switch (status) {
+	case FIX_UPDATED:
+		return "updated";
+	case FIX_NOT_WRITTEN:
+		return "not written";
+	case FIX_ALREADY_OK:
+		return "already configured";
+	case FIX_NEEDS_FIX:
+		return "needs fix";
+	case FIX_BAD_CHECKSUM:
+		return "bad checksum";
+	default:
+		return "failed";
+	}
+}
+
+static int fix_error(struct ftdi_context *ftdi, struct fix_result *res,
+		int ret, const char *what)
+{
+	printf("%s%s%s: %d %s\n", res->path, (res->path[0]) ? ": " : "",
+	       what, ret, ftdi_get_error_string(ftdi));
+	snprintf(res->msg, sizeof(res->msg), "%s: %s", what,
+		 ftdi_get_error_string(ftdi));
+	res->ret = ret;
+	res->status = FIX_FAILED;
+	return ret;
+}
+
+/* board profile for the device: forced one, else first matching one,
+ * else built-in profile
+ */
+static const struct board_profile *fix_profile(struct ftdi_context *ftdi,
+		const struct fix_config *cfg, struct fix_result *res)
+{
+	const struct board_profile *prof;
+
+	prof = cfg->profile;
+	if (prof == NULL && cfg->profiles)
+		prof = profile_match(cfg->profiles, ftdi);
+	else if (prof == NULL)
+		prof = profile_builtin();
+	if (prof == NULL) {
+		printf("%s%sno matching board profile\n", res->path,
+		       (res->path[0]) ? ": " : "");
+		snprintf(res->msg, sizeof(res->msg), "no matching profile");
+		res->ret = -1;
+		res->status = FIX_FAILED;
+		return NULL;
+	}
+	snprintf(res->profile, sizeof(res->profile), "%s", prof->name);
+	if (cfg->decode_verbose)
+		printf("\nprofile: %s\n", prof->name);
+	return prof;
+}
+
+/* raw fast path: patch profile fields bits straight into eeprom->buf and
+ * update checksum incrementally, everything else is kept as read.
+ * return 1 when image can't be patched this way (unknown layout, bad
+ * checksum, field not in config bytes): caller does the full rebuild
+ */
+static int fix_patch_raw(struct ftdi_context *ftdi,
+		const struct fix_config *cfg, struct fix_result *res,
+		int *build_ret)
+{
+	struct ftdi_eeprom *eeprom = ftdi->eeprom;
+	const struct my_eeprom_layout *layout;
+	const struct board_profile *prof;
+	const struct profile_patch *failed;
+	struct my_eeprom_image img;
+	unsigned short stored;
+	int size = eeprom->size;
+	double t = fix_now_ms();
+
+	layout = my_ftdi_eeprom_layout(ftdi->type);
+	if (layout == NULL || size <= 0 || size > FTDI_MAX_EEPROM_SIZE)
+		return 1;
+	my_eeprom_image_init(&img, layout, eeprom->buf, size, NULL);
+	stored = eeprom->buf[size - 2] | (eeprom->buf[size - 1] << 8);
+	if (stored != img.checksum)
+		return 1;
+
+	if (my_ftdi_eeprom_raw_ids(ftdi) != 0)
+		return 1;
+	if (eeprom->serial)
+		snprintf(res->serial, sizeof(res->serial), "%s",
+			 eeprom->serial);
+	fix_phase_end(res, FIX_PHASE_DECODE, &t);
+
+	prof = fix_profile(ftdi, cfg, res);
+	if (prof == NULL)
+		return -1;
+	if (profile_apply_raw(prof, &img, &failed) != 0) {
+		if (cfg->decode_verbose)
+			printf("%s not in config bytes: full rebuild\n",
+			       failed->name);
+		return 1;
+	}
+	my_eeprom_image_update(&img);
+	memcpy(eeprom->buf, img.buf, size);
+	eeprom->initialized_for_connected_device = 1;
+	*build_ret = 0;
+	fix_phase_end(res, FIX_PHASE_PATCH, &t);
+
+	if (cfg->decode_verbose) {
+		printf("\n\nNew configuration\n\n");
+		ftdi_eeprom_decode(ftdi, 1);
+	}
+
+	return 0;
+}
+
+/* decode EEPROM content in eeprom->buf, apply fix and build new image.
+ * build_ret is my_ftdi_eeprom_build() return code
+ */
+static int fix_patch(struct ftdi_context *ftdi, const struct fix_config *cfg,
+		struct fix_result *res, int *build_ret)
+{
+	const struct board_profile *prof;
+	const struct profile_patch *failed;
+	char what[64];
+	int ret;
+	double t;
+
+	if (cfg->raw_patch) {
+		ret = fix_patch_raw(ftdi, cfg, res, build_ret);
+		if (ret <= 0)
+			return ret;
+	}
+	t = fix_now_ms();
+
+	/* decode original EEPROM and display details */
+	if (cfg->decode_verbose)
+		printf("\n\nDefault configuration\n\n");
+
+	ret = ftdi_eeprom_decode(ftdi, cfg->decode_verbose);
+	if (ret != 0)
+		return fix_error(ftdi, res, ret, "FTDI decode EEPROM failed");
+	if (ftdi->eeprom->serial)
+		snprintf(res->serial, sizeof(res->serial), "%s",
+			 ftdi->eeprom->serial);
+	fix_phase_end(res, FIX_PHASE_DECODE, &t);
+
+	prof = fix_profile(ftdi, cfg, res);
+	if (prof == NULL)
+		return -1;
+
+	/* whole table was validated at load: one pass */
+	ret = profile_apply(prof, ftdi, &failed);
+	if (ret != 0) {
+		snprintf(what, sizeof(what), "FTDI set %s failed",
+			 failed->name);
+		return fix_error(ftdi, res, ret, what);
+	}
+	fix_phase_end(res, FIX_PHASE_PATCH, &t);
+
+	/* generate new EEPROM */
+	/* my_ftdi_eeprom_build is a modified version */
+	*build_ret = my_ftdi_eeprom_build(ftdi);
+	fix_phase_end(res, FIX_PHASE_BUILD, &t);
+	if (*build_ret < 0) {
+		printf("FTDI EEPROM_build failed: %d %s\n", *build_ret,
+		       ftdi_get_error_string(ftdi));
+	}
+
+	if (cfg->decode_verbose) {
+		/* decode original EEPROM and display details */
+		printf("\n\nNew configuration\n\n");
+		ftdi_eeprom_decode(ftdi, 1);
+	}
+
+	return 0;
+}
+
+static void fix_sleep_ms(int ms)
+{
+	struct timespec ts;
+
+	if (ms <= 0)
+		return;
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000L;
+	nanosleep(&ts, NULL);
+}
+
+int fix_write_fatal(int ret)
+{
+	/* -2: USB device unavailable, -3: EEPROM not initialized */
+	return ret == -2 || ret == -3;
+}
+
+/* read back words modified between orig and eeprom->buf and rewrite only
+ * those which don't match, with bounded retries and backoff.
+ * return 0 when device content matches eeprom->buf
+ */
+int fix_verify(struct fix_dev *dev, const struct fix_config *cfg,
+		const unsigned char *orig, struct fix_result *res)
+{
+	struct ftdi_context *ftdi = dev->ftdi;
+	unsigned char *image = ftdi->eeprom->buf;
+	unsigned char changed[FTDI_MAX_EEPROM_SIZE / 2];
+	unsigned char dev_image[FTDI_MAX_EEPROM_SIZE];
+	unsigned short val;
+	int i, ret, round, nb_bad = 0;
+	int backoff = cfg->verify_backoff_ms;
+
+	my_ftdi_eeprom_diff(ftdi, orig, changed);
+
+	for (round = 0; round <= cfg->verify_retries; round++) {
+		/* device content as seen now, for words to check */
+		memcpy(dev_image, image, FTDI_MAX_EEPROM_SIZE);
+		nb_bad = 0;
+		for (i = 0; i < ftdi->eeprom->size / 2; i++) {
+			if (!changed[i])
+				continue;
+			if (dev->ops->read_word(dev, i, &val) != 0) {
+				/* unknown content: force a rewrite */
+				val = ~(image[i * 2] | (image[i * 2 + 1] << 8));
+			}
+			dev_image[i * 2] = val & 0xff;
+			dev_image[i * 2 + 1] = val >> 8;
+			if (memcmp(dev_image + i * 2, image + i * 2, 2) != 0)
+				nb_bad++;
+		}
+		if (nb_bad == 0)
+			return 0;
+		if (round == cfg->verify_retries)
+			break;
+
+		/* give a marginal link some time before trying again */
+		fix_sleep_ms(backoff);
+		backoff *= 2;
+		res->verify_rounds++;
+		dev->stats.retries += nb_bad;
+		/* only mismatched words differ from dev_image */
+		ret = dev->ops->write_eeprom(dev, dev_image, cfg->async_window,
+					     cfg->write_delay_us,
+					     cfg->write_retries);
+		if (ret > 0)
+			res->words_written += ret;
+	}
+
+	ftdi->error_str = "EEPROM verify failed";
+	return -nb_bad;
+}
+
+/* stored checksum of buf (size bytes) matches its content */
+static int fix_checksum_ok(struct ftdi_context *ftdi,
+		const unsigned char *buf, int size)
+{
+	struct my_eeprom_image img;
+
+	if (size <= 0 || size > FTDI_MAX_EEPROM_SIZE)
+		return 0;
+	my_eeprom_image_init(&img, my_ftdi_eeprom_layout(ftdi->type), buf,
+			     size, NULL);
+	return img.checksum == (buf[size - 2] | (buf[size - 1] << 8));
+}
+
+/* write words of eeprom->buf which differ from orig, verify and reset.
+ * with a journal, it is on disk before the first word and marked done
+ * (removed when restoring) once the device content is verified
+ */
+static int fix_commit(struct fix_dev *dev, const struct fix_config *cfg,
+		struct fix_result *res, const unsigned char *orig,
+		struct fix_journal *j)
+{
+	struct ftdi_context *ftdi = dev->ftdi;
+	double t = fix_now_ms();
+	int ret;
+
+	if (j && journal_save(cfg->state_dir, j) != 0) {
+		snprintf(res->msg, sizeof(res->msg), "journal save failed");
+		res->ret = -1;
+		res->status = FIX_FAILED;
+		return -1;
+	}
+
+	/* flash only modified words into SPI flash */
+	ret = dev->ops->write_eeprom(dev, orig, cfg->async_window,
+				     cfg->write_delay_us, cfg->write_retries);
+	if (ret > 0)
+		res->words_written = ret;
+	fix_phase_end(res, FIX_PHASE_WRITE, &t);
+	/* a failed write goes through verify: only bad words are
+	 * written again
+	 */
+	if (fix_write_fatal(ret))
+		return fix_error(ftdi, res, ret, "FTDI write EEPROM failed");
+	ret = fix_verify(dev, cfg, orig, res);
+	fix_phase_end(res, FIX_PHASE_VERIFY, &t);
+	/* never reset a device with a half written EEPROM */
+	if (ret != 0)
+		return fix_error(ftdi, res, ret, "FTDI verify EEPROM failed");
+	res->status = FIX_UPDATED;
+
+	if (j && cfg->restore) {
+		journal_remove(j);
+	} else if (j) {
+		j->done = 1;
+		journal_save(cfg->state_dir, j);
+	}
+
+	t = fix_now_ms();
+	dev->ops->reset(dev);
+	res->reset = 1;
+	fix_phase_end(res, FIX_PHASE_RESET, &t);
+
+	return 0;
+}
+
+/* journal of the device read into eeprom->buf: with cfg->restore write
+ * back its original image, else finish an interrupted write.
+ * return 1 when there is nothing to resume: usual flow goes on
+ */
+static int fix_journal_resume(struct fix_dev *dev,
+		const struct fix_config *cfg, struct fix_result *res,
+		struct fix_journal *j)
+{
+	struct ftdi_context *ftdi = dev->ftdi;
+	unsigned char cur[FTDI_MAX_EEPROM_SIZE];
+	const char *serial = NULL;
+	int ret;
+
+	memcpy(cur, ftdi->eeprom->buf, FTDI_MAX_EEPROM_SIZE);
+	if (ftdi->eeprom->size > 0 && my_ftdi_eeprom_raw_ids(ftdi) == 0)
+		serial = ftdi->eeprom->serial;
+	ret = journal_load(cfg->state_dir, serial, res->path, cur, j);
+	if (ret > 0)
+		memset(j, 0, sizeof(*j));
+	/* orig of an interrupted restore is the only factory image left */
+	if (ret == 0 && j->restoring && !cfg->restore)
+		ret = -2;
+	if (ret < 0 || (ret > 0 && cfg->restore)) {
+		snprintf(res->msg, sizeof(res->msg), "%s",
+			 (ret == -2) ? "interrupted restore, restore again" :
+			 (ret < 0) ? "journal load failed" : "no journal");
+		printf("%s%s%s\n", res->path, (res->path[0]) ? ": " : "",
+		       res->msg);
+		res->ret = -1;
+		res->status = FIX_FAILED;
+		return -1;
+	}
+	if (ret > 0 || (j->done && !cfg->restore))
+		return 1;
+	if (!cfg->restore && memcmp(cur, j->target, j->size) == 0) {
+		/* written, not marked done yet */
+		j->done = 1;
+		journal_save(cfg->state_dir, j);
+		return 1;
+	}
+
+	snprintf(res->serial, sizeof(res->serial), "%s", j->serial);
+	snprintf(res->journal, sizeof(res->journal), "%s",
+		 cfg->restore ? "restored" : "resumed");
+	memcpy(ftdi->eeprom->buf, cfg->restore ? j->orig : j->target, j->size);
+	ftdi->eeprom->size = j->size;
+	ftdi->eeprom->initialized_for_connected_device = 1;
+	for (ret = 0; ret < j->size; ret++)
+		res->bytes_changed += (cur[ret] != ftdi->eeprom->buf[ret]);
+	if (res->bytes_changed == 0) {
+		res->status = FIX_ALREADY_OK;
+		if (cfg->restore)
+			journal_remove(j);
+		return 0;
+	}
+	res->status = FIX_NOT_WRITTEN;
+	if (cfg->dont_write)
+		return 0;
+	/* from now on the device holds neither image */
+	if (cfg->restore) {
+		j->done = 0;
+		j->restoring = 1;
+	}
+	return fix_commit(dev, cfg, res, cur, j);
+}
+
+static int fix_device_run(struct fix_dev *dev, const struct fix_config *cfg,
+		struct fix_result *res)
+{
+	struct ftdi_context *ftdi = dev->ftdi;
+	struct fix_journal journal, *j = NULL;
+	int i, ret, build_ret;
+	double t = fix_now_ms();
+	unsigned char orig[FTDI_MAX_EEPROM_SIZE];
+
+	/* fetch EEPROM from device */
+	ret = dev->ops->read_eeprom(dev, cfg->async_window);
+	fix_phase_end(res, FIX_PHASE_READ, &t);
+	if (ret != 0)
+		return fix_error(ftdi, res, ret, "FTDI read EEPROM failed");
+	/* keep a copy: build overwrites eeprom->buf */
+	memcpy(orig, ftdi->eeprom->buf, FTDI_MAX_EEPROM_SIZE);
+
+	/* decode refuses such an image: report it instead of failing */
+	if (cfg->audit &&
+	    !fix_checksum_ok(ftdi, ftdi->eeprom->buf, ftdi->eeprom->size)) {
+		if (my_ftdi_eeprom_raw_ids(ftdi) == 0 && ftdi->eeprom->serial)
+			snprintf(res->serial, sizeof(res->serial), "%s",
+				 ftdi->eeprom->serial);
+		res->status = FIX_BAD_CHECKSUM;
+		return 0;
+	}
+
+	if (cfg->state_dir && !cfg->audit) {
+		ret = fix_journal_resume(dev, cfg, res, &journal);
+		if (ret <= 0)
+			return ret;
+		/* journal was only looked at: start again from read image */
+		memcpy(ftdi->eeprom->buf, orig, FTDI_MAX_EEPROM_SIZE);
+		j = &journal;
+	}
+
+	ret = fix_patch(ftdi, cfg, res, &build_ret);
+	if (ret != 0)
+		return ret;
+	/* half built image, wrong checksum: never to be written */
+	if (build_ret < 0)
+		return fix_error(ftdi, res, build_ret,
+				 "FTDI EEPROM_build failed");
+
+	for (i = 0; i < ftdi->eeprom->size; i++)
+		res->bytes_changed += (orig[i] != ftdi->eeprom->buf[i]);
+
+	/* nothing to do: avoid EEPROM wear and device re-enumeration */
+	if (ftdi->eeprom->size > 0 && res->bytes_changed == 0) {
+		res->status = FIX_ALREADY_OK;
+		return 0;
+	}
+	if (cfg->audit) {
+		res->status = FIX_NEEDS_FIX;
+		return 0;
+	}
+
+	res->status = FIX_NOT_WRITTEN;
+	/* nothing changed on device: leave it (and its users) alone */
+	if (cfg->dont_write)
+		return 0;
+
+	if (j) {
+		/* a journal of a previous fix keeps its orig: factory image */
+		if (j->size != ftdi->eeprom->size) {
+			memset(j, 0, sizeof(*j));
+			j->size = ftdi->eeprom->size;
+			snprintf(j->serial, sizeof(j->serial), "%s",
+				 res->serial);
+			snprintf(j->path, sizeof(j->path), "%s", res->path);
+			memcpy(j->orig, orig, j->size);
+		}
+		j->done = 0;
+		memcpy(j->target, ftdi->eeprom->buf, j->size);
+	}
+	return fix_commit(dev, cfg, res, orig, j);
+}
+
+/* write image as is, journaled like a fix. A journal of the device,
+ * done or not, keeps its original image: restore still goes back to it
+ */
+static int fix_image_run(struct fix_dev *dev, const struct fix_config *cfg,
+		const unsigned char *image, int size, struct fix_result *res)
+{
+	struct ftdi_context *ftdi = dev->ftdi;
+	struct fix_journal journal, *j = NULL;
+	const char *serial = NULL;
+	int i, ret;
+	double t = fix_now_ms();
+	unsigned char orig[FTDI_MAX_EEPROM_SIZE];
+
+	ret = dev->ops->read_eeprom(dev, cfg->async_window);
+	fix_phase_end(res, FIX_PHASE_READ, &t);
+	if (ret != 0)
+		return fix_error(ftdi, res, ret, "FTDI read EEPROM failed");
+	memcpy(orig, ftdi->eeprom->buf, FTDI_MAX_EEPROM_SIZE);
+	if (my_ftdi_eeprom_raw_ids(ftdi) == 0 && ftdi->eeprom->serial) {
+		serial = ftdi->eeprom->serial;
+		snprintf(res->serial, sizeof(res->serial), "%s", serial);
+	}
+
+	if (size != ftdi->eeprom->size) {
+		snprintf(res->msg, sizeof(res->msg),
+			 "image size %d, EEPROM size %d", size,
+			 ftdi->eeprom->size);
+		res->ret = -1;
+		return -1;
+	}
+	/* a device with a wrong checksum doesn't come back */
+	if (!fix_checksum_ok(ftdi, image, size)) {
+		snprintf(res->msg, sizeof(res->msg), "image checksum mismatch");
+		res->ret = -1;
+		return -1;
+	}
+
+	for (i = 0; i < size; i++)
+		res->bytes_changed += (orig[i] != image[i]);
+	if (res->bytes_changed == 0) {
+		res->status = FIX_ALREADY_OK;
+		return 0;
+	}
+	res->status = FIX_NOT_WRITTEN;
+	if (cfg->dont_write)
+		return 0;
+
+	if (cfg->state_dir) {
+		j = &journal;
+		ret = journal_load(cfg->state_dir, serial, res->path, orig, j);
+		if (ret < 0) {
+			snprintf(res->msg, sizeof(res->msg),
+				 "journal load failed");
+			res->ret = -1;
+			res->status = FIX_FAILED;
+			return -1;
+		}
+		if (ret == 0 && j->restoring) {
+			snprintf(res->msg, sizeof(res->msg),
+				 "interrupted restore, restore again");
+			res->ret = -1;
+			res->status = FIX_FAILED;
+			return -1;
+		}
+		if (ret > 0) {
+			memset(j, 0, sizeof(*j));
+			j->size = size;
+			snprintf(j->serial, sizeof(j->serial), "%s",
+				 res->serial);
+			snprintf(j->path, sizeof(j->path), "%s", res->path);
+			memcpy(j->orig, orig, size);
+		}
+		j->done = 0;
+		memcpy(j->target, image, size);
+	}
+
+	memcpy(ftdi->eeprom->buf, image, size);
+	ftdi->eeprom->initialized_for_connected_device = 1;
+	return fix_commit(dev, cfg, res, orig, j);
+}
+
+/* common part of fix_device() and fix_image(): image NULL for a fix */
+static int fix_run(struct fix_dev *dev, const struct fix_config *cfg,
+		const unsigned char *image, int size, struct fix_result *res)
+{
+	double start = fix_now_ms();
+	struct my_ftdi_stats stats = dev->stats;
+	int i, ret;
+
+	res->status = FIX_FAILED;
+	res->ret = 0;
+	res->words_written = 0;
+	res->bytes_changed = 0;
+	res->verify_rounds = 0;
+	res->reset = 0;
+	res->msg[0] = '\0';
+	res->serial[0] = '\0';
+	res->journal[0] = '\0';
+	/* open phase is filled by the caller */
+	for (i = FIX_PHASE_READ; i < FIX_PHASE_NR; i++)
+		res->phase_ms[i] = 0;
+	if (res->path[0] == '\0')
+		snprintf(res->path, sizeof(res->path), "%s", dev->path);
+
+	if (image)
+		ret = fix_image_run(dev, cfg, image, size, res);
+	else
+		ret = fix_device_run(dev, cfg, res);
+
+	res->transfers = dev->stats.transfers - stats.transfers;
+	res->retries = dev->stats.retries - stats.retries;
+	res->failures = dev->stats.failures - stats.failures;
+	res->elapsed_ms = fix_now_ms() - start;
+	return ret;
+}
+
+int fix_device(struct fix_dev *dev, const struct fix_config *cfg,
+		struct fix_result *res)
+{
+	return fix_run(dev, cfg, NULL, 0, res);
+}
+
+int fix_image(struct fix_dev *dev, const struct fix_config *cfg,
+		const unsigned char *image, int size, struct fix_result *res)
+{
+	return fix_run(dev, cfg, image, size, res);
+}
+
+static void json_string(FILE *fd, const char *str)
+{
+	fputc('"', fd);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fprintf(fd, "\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			fprintf(fd, "\\u%04x", *str);
+		else
+			fputc(*str, fd);
+	}
+	fputc('"', fd);
+}
+
+void fix_result_json(FILE *fd, const struct fix_result *res)
+{
+	int i;
+
+	fprintf(fd, "{\"path\":");
+	json_string(fd, res->path);
+	fprintf(fd, ",\"serial\":");
+	json_string(fd, res->serial);
+	fprintf(fd, ",\"profile\":");
+	json_string(fd, res->profile);
+	fprintf(fd, ",\"status\":");
+	json_string(fd, fix_status_str(res->status));
+	fprintf(fd, ",\"error\":");
+	json_string(fd, res->msg);
+	fprintf(fd, ",\"journal\":");
+	json_string(fd, res->journal);
+	fprintf(fd, ",\"ret\":%d,\"elapsed_ms\":%.3f,\"phases_ms\":{",
+		res->ret, res->elapsed_ms);
+	for (i = 0; i < FIX_PHASE_NR; i++)
+		fprintf(fd, "%s\"%s\":%.3f", i ? "," : "", fix_phase_str(i),
+			res->phase_ms[i]);
+	fprintf(fd, "},\"transfers\":%lu,\"retries\":%lu,\"failures\":%lu,"
+		"\"bytes_changed\":%d,\"words_written\":%d,"
+		"\"verify_rounds\":%d,\"reset\":%s}\n",
+		res->transfers, res->retries, res->failures,
+		res->bytes_changed, res->words_written, res->verify_rounds,
+		res->reset ? "true" : "false");
+	fflush(fd);
+}
+
+void fix_result_csv_header(FILE *fd)
+{
+	fprintf(fd, "serial,path,profile,status,bytes_changed,error\n");
+}
+
+/* quote a field only when needed */
+static void csv_string(FILE *fd, const char *str)
+{
+	if (strpbrk(str, ",\"\r\n") == NULL) {
+		fputs(str, fd);
+		return;
+	}
+	fputc('"', fd);
+	for (; *str; str++) {
+		if (*str == '"')
+			fputc('"', fd);
+		fputc(*str, fd);
+	}
+	fputc('"', fd);
+}
+
+void fix_result_csv(FILE *fd, const struct fix_result *res)
+{
+	csv_string(fd, res->serial);
+	fputc(',', fd);
+	csv_string(fd, res->path);
+	fputc(',', fd);
+	csv_string(fd, res->profile);
+	fprintf(fd, ",%s,%d,", fix_status_str(res->status),
+		res->bytes_changed);
+	csv_string(fd, res->msg);
+	fputc('\n', fd);
+	fflush(fd);
+}
+
+static const struct {
+	const char *name;
+	enum ftdi_chip_type type;
+} fix_chip_types[] = {
+	{"2232c", TYPE_2232C},
+	{"r", TYPE_R},
+	{"2232h", TYPE_2232H},
+	{"4232h", TYPE_4232H},
+	{"232h", TYPE_232H},
+};
+
+int fix_chip_type(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(fix_chip_types) / sizeof(fix_chip_types[0]); i++)
+		if (strcasecmp(name, fix_chip_types[i].name) == 0)
+			return fix_chip_types[i].type;
+	return -1;
+}
+
+/* temporary file then rename: out is never left half written. a device
+ * or a pipe (ie. /dev/stdout) is written in place
+ */
+static int fix_save_image(const char *out, const unsigned char *buf,
+		int size, struct fix_result *res)
+{
+	char tmp[PATH_MAX + 8];
+	struct stat st;
+	FILE *fd;
+	int ok, in_place;
+
+	in_place = stat(out, &st) == 0 && !S_ISREG(st.st_mode);
+	snprintf(tmp, sizeof(tmp), "%s%s", out, (in_place) ? "" : ".tmp");
+	if ((fd = fopen(tmp, "wb")) == NULL) {
+		snprintf(res->msg, sizeof(res->msg), "%s: %s", out,
+			 strerror(errno));
+		printf("%s\n", res->msg);
+		return -1;
+	}
+	/* a short write doesn't always set errno */
+	errno = 0;
+	ok = fwrite(buf, 1, size, fd) == (size_t)size && fflush(fd) == 0;
+	if (fclose(fd) != 0 || !ok ||
+	    (!in_place && rename(tmp, out) != 0)) {
+		snprintf(res->msg, sizeof(res->msg), "%s: %s", out,
+			 (errno) ? strerror(errno) : "write failed");
+		printf("%s\n", res->msg);
+		if (!in_place)
+			unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+int fix_file(const char *in, const char *out, int type,
+		const struct fix_config *cfg, struct fix_result *res)
+{
+	struct ftdi_context *ftdi;
+	unsigned char orig[FTDI_MAX_EEPROM_SIZE];
+	int ret = -1, build_ret, size;
+	double start = fix_now_ms();
+	FILE *fd;
+
+	memset(res, 0, sizeof(*res));
+	res->status = FIX_FAILED;
+	snprintf(res->path, sizeof(res->path), "%s", in);
+
+	if ((ftdi = ftdi_new()) == NULL) {
+		snprintf(res->msg, sizeof(res->msg),
+			 "FTDI context allocation failed");
+		return -1;
+	}
+	/* no device: chip type comes from the user */
+	ftdi->type = type;
+
+	memset(orig, 0, sizeof(orig));
+	if ((fd = fopen(in, "rb")) == NULL) {
+		snprintf(res->msg, sizeof(res->msg), "%s: %s", in,
+			 strerror(errno));
+		printf("%s\n", res->msg);
+		goto cleanup;
+	}
+	size = fread(orig, 1, FTDI_MAX_EEPROM_SIZE, fd);
+	fclose(fd);
+	if (size != 0x80 && size != FTDI_MAX_EEPROM_SIZE) {
+		snprintf(res->msg, sizeof(res->msg),
+			 "%s: invalid EEPROM image size %d", in, size);
+		printf("%s\n", res->msg);
+		goto cleanup;
+	}
+
+	memcpy(ftdi->eeprom->buf, orig, FTDI_MAX_EEPROM_SIZE);
+	if (size == 0x80)
+		ftdi->eeprom->size = 0x80;
+	else
+		my_ftdi_eeprom_guess_size(ftdi);
+
+	ret = fix_patch(ftdi, cfg, res, &build_ret);
+	if (ret != 0)
+		goto cleanup;
+	if (build_ret < 0) {
+		ret = fix_error(ftdi, res, build_ret, "FTDI EEPROM_build failed");
+		goto cleanup;
+	}
+
+	for (size = 0; size < ftdi->eeprom->size; size++)
+		res->bytes_changed += (orig[size] != ftdi->eeprom->buf[size]);
+	if (res->bytes_changed == 0)
+		res->status = FIX_ALREADY_OK;
+	else
+		res->status = FIX_UPDATED;
+
+	if (fix_save_image(out, ftdi->eeprom->buf, ftdi->eeprom->size,
+			   res) != 0) {
+		res->status = FIX_FAILED;
+		ret = -1;
+	}
+cleanup:
+	res->elapsed_ms = fix_now_ms() - start;
+	ftdi_free(ftdi);
+	return ret;
+}
@@ -0,0 +1,115 @@
+#ifndef FIX_H_
+#define FIX_H_
+#include <stdio.h>
+#include <ftdi.h>
+
+struct board_profile;
+struct metrics;
+
+/* per-run options shared by single device and fleet modes */
+struct fix_config {
+	int dont_write;
+	int decode_verbose;
+	int passive;		/* open without detaching/claiming (USB) */
+	int async_window;	/* pending EEPROM transfers, <= 1: blocking */
+	int write_delay_us;	/* min delay between two async word writes */
+	int write_retries;	/* extra async passes for failed words */
+	int verify_retries;	/* rewrite rounds for mismatched words */
+	int verify_backoff_ms;	/* delay before first rewrite, doubled */
+	FILE *json;		/* when set, one JSON record per device */
+	FILE *csv;		/* when set, CSV report of a fleet run */
+	struct metrics *metrics;	/* when set, every device run counted */
+	/* board profile applied: forced one, else first of profiles
+	 * matching the device, else built-in profile
+	 */
+	const struct board_profile *profile;
+	const struct board_profile *profiles;
+	int raw_patch;		/* patch read image in place, no rebuild */
+	int audit;		/* classify only: no write, no reset */
+	/* when set, writes are journaled there and interrupted ones resumed */
+	const char *state_dir;
+	int restore;		/* write back journaled original image */
+};
+
+enum fix_status {
+	FIX_FAILED = -1,
+	FIX_UPDATED = 0,
+	FIX_NOT_WRITTEN,
+	FIX_ALREADY_OK,		/* EEPROM content already matches */
+	FIX_NEEDS_FIX,		/* audit: fix would change EEPROM */
+	FIX_BAD_CHECKSUM,	/* audit: stored checksum is wrong */
+};
+
+/* fix flow steps, timed in struct fix_result */
+enum fix_phase {
+	FIX_PHASE_OPEN = 0,	/* filled by the caller opening the device */
+	FIX_PHASE_READ,
+	FIX_PHASE_DECODE,
+	FIX_PHASE_PATCH,	/* board profile patch table */
+	FIX_PHASE_BUILD,
+	FIX_PHASE_WRITE,
+	FIX_PHASE_VERIFY,	/* read back and rewrites */
+	FIX_PHASE_RESET,
+	FIX_PHASE_NR
+};
+
+/* outcome of one device provisioning */
+struct fix_result {
+	char path[32];		/* USB topology path: bus-port[.port...] */
+	char serial[64];
+	char profile[32];	/* board profile applied */
+	int status;		/* enum fix_status */
+	int ret;		/* last libftdi return code */
+	int words_written;
+	char msg[128];		/* error string when status == FIX_FAILED */
+	char journal[16];	/* "resumed" or "restored" write */
+	double phase_ms[FIX_PHASE_NR];
+	unsigned long transfers;	/* control transfers issued */
+	unsigned long retries;		/* transfers issued again */
+	unsigned long failures;		/* transfers failed */
+	int bytes_changed;		/* built image vs read image */
+	int verify_rounds;		/* rewrites needed to verify */
+	int reset;			/* device has been reset */
+	double elapsed_ms;
+};
+
+struct fix_dev;
+
+/* read, patch, build and write EEPROM of an already opened device */
+int fix_device(struct fix_dev *dev, const struct fix_config *cfg,
+		struct fix_result *res);
+/* read, then write words of image (size bytes, EEPROM size, valid
+ * checksum) which differ, verify and reset. journaled with state_dir
+ */
+int fix_image(struct fix_dev *dev, const struct fix_config *cfg,
+		const unsigned char *image, int size, struct fix_result *res);
+/* read back words of eeprom->buf which differ from orig and rewrite
+ * mismatched ones (cfg->verify_retries rounds), 0 when device matches
+ */
+int fix_verify(struct fix_dev *dev, const struct fix_config *cfg,
+		const unsigned char *orig, struct fix_result *res);
+/* write_eeprom() return code after which verify is pointless: device
+ * gone or EEPROM not initialized. Other failures are left to verify
+ */
+int fix_write_fatal(int ret);
+
+/* offline mode: apply fix on a raw EEPROM image file (128 or 256 bytes)
+ * and write result into out, type is an enum ftdi_chip_type
+ */
+int fix_file(const char *in, const char *out, int type,
+		const struct fix_config *cfg, struct fix_result *res);
+/* enum ftdi_chip_type from name (2232h, 4232h, ...), -1 if unknown */
+int fix_chip_type(const char *name);
+
+/* fill buf with sysfs like topology path (ie. 1-2.4) */
+int fix_usb_path(struct libusb_device *dev, char *buf, int len);
+
+const char *fix_status_str(int status);
+const char *fix_phase_str(int phase);
+/* write res as a single line JSON object */
+void fix_result_json(FILE *fd, const struct fix_result *res);
+/* write res as a CSV line, fix_result_csv_header() gives columns */
+void fix_result_csv_header(FILE *fd);
+void fix_result_csv(FILE *fd, const struct fix_result *res);
+double fix_now_ms(void);
+#endif
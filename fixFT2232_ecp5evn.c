@@ -16,141 +16,465 @@
 */
 
 #include <stdio.h>
+#include <getopt.h>
 #include <ftdi.h>
 #include <libusb.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include "ftdi_i.h"
 #include "myftdi.h"
+#include "fix.h"
+#include "transport.h"
+#include "sim.h"
+#include "fleet.h"
+#include "daemon.h"
+#include "service.h"
+#include "metrics.h"
+#include "profile.h"
+#include "devindex.h"
+#include "libfixft.h"
 
-int main(int argc, char **argv)
+static void usage(const char *name)
 {
-	int ret, i;
-	struct ftdi_context *ftdi;
-	int vendor_id = 0x403, product_id = 0x6010;
-	int dont_write = 0;
+	printf("%s [-v vid] [-p pid] [options] [mode]\n", name);
+	printf(" modes, one at most (default: first vid:pid device):\n");
+	printf("   --path p | --serial s             one device\n");
+	printf("   -a | --audit [--csv f] [-j jobs]  every vid:pid device\n");
+	printf("   -d [-j jobs]                      devices as plugged\n");
+	printf("   --service sock [--socket-mode m] [-j jobs]\n");
+	printf("   -i in -o out [-t type]            offline image file\n");
+	printf(" options: -n -q -w --raw --no-detach --profile(s) --sim\n");
+	printf("   --state-dir dir [--restore] --json f --metrics f ...\n");
+	printf("\n");
+	printf("   -v default: 0x403\n");
+	printf("   -p default: 0x6010\n");
+	printf("   -n to not write into FTDI EEPROM (nor reset device)\n");
+	printf("   --path p only the device at USB topology path p (1-2.4)\n");
+	printf("      or bus:addr (3:12)\n");
+	printf("   --serial s only the vid:pid device with serial s, found\n");
+	printf("      from sysfs without opening other devices\n");
+	printf("   -a fix all matching devices\n");
+	printf("   --audit read-only -a: report each device as already\n");
+	printf("      configured, needs fix or bad checksum, no write/reset\n");
+	printf("   -j max devices handled in parallel with -a or -d "
+	       "(default: 8)\n");
+	printf("   -d daemon: fix devices as they are plugged, until ^C\n");
+	printf("   --service sock serve audit/fix/flash requests on UNIX\n");
+	printf("      socket sock, -j runs in parallel, until ^C\n");
+	printf("   --socket-mode octal permissions of the --service socket "
+	       "(default: 600)\n");
+	printf("   -w max pending EEPROM transfers (default: 0, blocking)\n");
+	printf("   --write-delay min delay (us) between two pipelined word writes\n");
+	printf("   --retries retry passes for failed words with -w (default: 2)\n");
+	printf("   --verify-retries rewrite rounds for mismatched words "
+	       "(default: 3)\n");
+	printf("   --verify-backoff delay (ms) before first rewrite, doubled "
+	       "each round (default: 10)\n");
+	printf("   --compare-read time blocking and pipelined reads\n");
+	printf("   -i raw EEPROM image to fix, offline (no device)\n");
+	printf("   -o fixed EEPROM image file (with -i)\n");
+	printf("   -t chip type for -i: 2232c, r, 2232h, 4232h, 232h "
+	       "(default: 2232h)\n");
+	printf("   --sim count[,chip=56][,latency=us][,prog=us][,fail=rate]"
+	       "[,wfail=rate][,seed=n][,image=file]\n");
+	printf("      use simulated FT2232H boards instead of USB devices\n");
+	printf("   --profiles file board profiles, first one matching a device "
+	       "is applied\n");
+	printf("   --profile name apply this profile to every device "
+	       "(default: ecp5-evn)\n");
+	printf("   --no-detach keep kernel driver and don't claim interface:\n");
+	printf("      running tty/JTAG sessions are left untouched\n");
+	printf("   --raw patch profile fields in the read image, no decode nor\n");
+	printf("      rebuild: strings and other bytes are kept as read\n");
+	printf("   --state-dir dir journal writes in dir: an interrupted write\n");
+	printf("      is resumed by the next run\n");
+	printf("   --restore write back the image journaled before last write\n");
+	printf("      (with --state-dir)\n");
+	printf("   -q don't display EEPROM content\n");
+	printf("   --json file one JSON record per device (- for stdout,\n");
+	printf("      text output then goes to stderr)\n");
+	printf("   --csv file CSV report of -a/--audit run (- for stdout)\n");
+	printf("   --metrics file Prometheus counters and phase latencies,\n");
+	printf("      rewritten after each device (textfile collector)\n");
+}
 
-	if (argc < 3) {
-		printf("%s -v vid -p pid [-n]\n", argv[0]);
-		printf("   -v default: 0x403\n");
-		printf("   -p default: 0x6010\n");
-		printf("   -n to not write into FTDI EEPROM\n");
-		return EXIT_FAILURE;
-	}
+/* JSON records or CSV report on stdout: keep stdout for them, move text
+ * to stderr
+ */
+static FILE *open_report(const char *name, const char *mode)
+{
+	FILE *fd;
+	int dup_fd;
 
-	for (i = 1; i < argc; i+=2) {
-		if (argv[i][1] == 'v')
-			sscanf(argv[i+1], "%x", &vendor_id);
-		if (argv[i][1] == 'p')
-			sscanf(argv[i+1], "%x", &product_id);
-		if (argv[i][1] == 'n')
-			dont_write = 1;
+	if (strcmp(name, "-") != 0) {
+		if ((fd = fopen(name, mode)) == NULL)
+			perror(name);
+		return fd;
 	}
-
-	printf("vendor %x product %x\n", vendor_id, product_id);
-
-	int decode_verbose = 1;
-
-	if ((ftdi = ftdi_new()) == NULL) {
-		printf("FTDI context allocation failed\n");
-		return EXIT_FAILURE;
+	fflush(stdout);
+	if ((dup_fd = dup(STDOUT_FILENO)) < 0 ||
+	    (fd = fdopen(dup_fd, "w")) == NULL) {
+		perror("stdout");
+		return NULL;
 	}
+	dup2(STDERR_FILENO, STDOUT_FILENO);
+	return fd;
+}
 
-	if (ftdi_usb_open(ftdi, vendor_id, product_id) != 0) {
-		printf("FTDI open failed: %s\n", ftdi_get_error_string(ftdi));
-		goto cleanup;
-	}
+/* read EEPROM with blocking and pipelined engines, check both images
+ * are the same and display speedup
+ */
+static int compare_read(struct fix_dev *dev, int window)
+{
+	struct ftdi_context *ftdi = dev->ftdi;
+	unsigned char sync_buf[FTDI_MAX_EEPROM_SIZE];
+	double start, sync_ms, async_ms;
+	int ret;
+
+	if (window <= 1)
+		window = MY_FTDI_ASYNC_WINDOW;
 
-	/* fetch EEPROM from device */
-	ret = ftdi_read_eeprom(ftdi);
+	start = fix_now_ms();
+	ret = dev->ops->read_eeprom(dev, 0);
+	sync_ms = fix_now_ms() - start;
 	if (ret != 0) {
 		printf("FTDI read EEPROM failed: %s\n",
 		       ftdi_get_error_string(ftdi));
-		goto cleanup;
+		return ret;
 	}
+	memcpy(sync_buf, ftdi->eeprom->buf, FTDI_MAX_EEPROM_SIZE);
 
-	/* decode original EEPROM and display details */
-	printf("\n\nDefault configuration\n\n");
-
-	ret = ftdi_eeprom_decode(ftdi, decode_verbose);
+	start = fix_now_ms();
+	ret = dev->ops->read_eeprom(dev, window);
+	async_ms = fix_now_ms() - start;
 	if (ret != 0) {
-		printf("FTDI decode EEPROM failed: %s\n",
+		printf("FTDI async read EEPROM failed: %s\n",
 		       ftdi_get_error_string(ftdi));
-		goto cleanup;
+		return ret;
 	}
 
-	/* set GROUP2 (BL/BDBUSx drive) */
-    ret = ftdi_set_eeprom_value(ftdi, GROUP2_DRIVE, DRIVE_4MA);
-	if (ret != 0) {
-		printf("FTDI set GROUP2 drive 4mA failed: %s\n",
-		       ftdi_get_error_string(ftdi));
-		goto cleanup;
+	printf("blocking read: %.2f ms\n", sync_ms);
+	printf("pipelined read (window %d): %.2f ms, speedup x%.2f\n",
+	       window, async_ms, (async_ms > 0) ? sync_ms / async_ms : 0);
+	if (memcmp(sync_buf, ftdi->eeprom->buf, FTDI_MAX_EEPROM_SIZE) != 0) {
+		printf("pipelined read content differs from blocking read\n");
+		return -1;
 	}
-	/* set GROUP2 (BL/BDBUSx slew rate) */
-    ret = ftdi_set_eeprom_value(ftdi, GROUP2_SLEW, SLOW_SLEW);
-	if (ret != 0) {
-		printf("FTDI set GROUP2 slow slew failed: %s\n",
-		       ftdi_get_error_string(ftdi));
-		goto cleanup;
+	return 0;
+}
+
+/* open the device given by --sim, --path, --serial or vid:pid */
+static struct fixft_session *open_session(struct fixft_ctx *ctx,
+		const struct sim_config *sim, const char *path,
+		const char *serial, int vendor_id, int product_id,
+		const struct fix_config *cfg)
+{
+	char index[PATH_MAX];
+
+	if (sim)
+		return fixft_open_sim(sim, 0);
+	if (path)
+		return fixft_open_path(ctx, path, cfg->passive);
+	if (serial == NULL)
+		return fixft_open(ctx, vendor_id, product_id, cfg->passive);
+	/* cached serial -> path map lives with the journals */
+	if (cfg->state_dir)
+		snprintf(index, sizeof(index), "%s/" DEVINDEX_FILE,
+			 cfg->state_dir);
+	return fixft_open_serial(ctx, serial, vendor_id, product_id,
+				 cfg->state_dir ? index : NULL, cfg->passive);
+}
+
+int main(int argc, char **argv)
+{
+	int ret, c;
+	struct fixft_ctx *ctx = NULL;
+	struct fixft_session *sess;
+	struct sim_config sim, *simp = NULL;
+	int vendor_id = 0x403, product_id = 0x6010;
+	int all = 0, daemon = 0, jobs = 8, cmp_read = 0;
+	char *in_file = NULL, *out_file = NULL, *profile_name = NULL;
+	char *sel_path = NULL, *sel_serial = NULL, *sock_path = NULL;
+	int sock_mode = 0600;
+	struct board_profile *profiles = NULL;
+	int chip_type = TYPE_2232H;
+	struct fix_config cfg = {
+		.dont_write = 0,
+		.decode_verbose = 1,
+		.async_window = 0,
+		.write_delay_us = 0,
+		.write_retries = 2,
+		.verify_retries = 3,
+		.verify_backoff_ms = 10,
+	};
+	struct fix_result res = {};
+	static const struct option long_options[] = {
+		{"vid", required_argument, 0, 'v'},
+		{"pid", required_argument, 0, 'p'},
+		{"dry-run", no_argument, 0, 'n'},
+		{"all", no_argument, 0, 'a'},
+		{"path", required_argument, 0, 'L'},
+		{"serial", required_argument, 0, 'N'},
+		{"audit", no_argument, 0, 'U'},
+		{"daemon", no_argument, 0, 'd'},
+		{"service", required_argument, 0, 'O'},
+		{"socket-mode", required_argument, 0, 'Y'},
+		{"jobs", required_argument, 0, 'j'},
+		{"window", required_argument, 0, 'w'},
+		{"compare-read", no_argument, 0, 'C'},
+		{"write-delay", required_argument, 0, 'D'},
+		{"retries", required_argument, 0, 'R'},
+		{"input", required_argument, 0, 'i'},
+		{"output", required_argument, 0, 'o'},
+		{"type", required_argument, 0, 't'},
+		{"sim", required_argument, 0, 'S'},
+		{"quiet", no_argument, 0, 'q'},
+		{"no-detach", no_argument, 0, 'P'},
+		{"raw", no_argument, 0, 'X'},
+		{"state-dir", required_argument, 0, 'G'},
+		{"restore", no_argument, 0, 'Z'},
+		{"profiles", required_argument, 0, 'F'},
+		{"profile", required_argument, 0, 'M'},
+		{"verify-retries", required_argument, 0, 'V'},
+		{"verify-backoff", required_argument, 0, 'B'},
+		{"json", required_argument, 0, 'J'},
+		{"csv", required_argument, 0, 'K'},
+		{"metrics", required_argument, 0, 'E'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	if (argc < 2) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
 	}
-	/* set GROUP3 (BH/BCBUSx drive) */
-    ret = ftdi_set_eeprom_value(ftdi, GROUP3_DRIVE, DRIVE_4MA);
-	if (ret != 0) {
-		printf("FTDI set GROUP3 drive 4mA failed: %s\n",
-		       ftdi_get_error_string(ftdi));
-		goto cleanup;
+
+	while ((c = getopt_long(argc, argv, "v:p:nadj:w:i:o:t:qh", long_options,
+				NULL)) != -1) {
+		switch (c) {
+		case 'v':
+			sscanf(optarg, "%x", &vendor_id);
+			break;
+		case 'p':
+			sscanf(optarg, "%x", &product_id);
+			break;
+		case 'n':
+			cfg.dont_write = 1;
+			break;
+		case 'a':
+			all = 1;
+			break;
+		case 'L':
+			sel_path = optarg;
+			break;
+		case 'N':
+			sel_serial = optarg;
+			break;
+		case 'd':
+			daemon = 1;
+			break;
+		case 'O':
+			sock_path = optarg;
+			break;
+		case 'Y':
+			sock_mode = strtol(optarg, NULL, 8);
+			if (sock_mode <= 0 || sock_mode > 0777) {
+				printf("invalid socket mode %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		case 'w':
+			cfg.async_window = atoi(optarg);
+			break;
+		case 'C':
+			cmp_read = 1;
+			break;
+		case 'D':
+			cfg.write_delay_us = atoi(optarg);
+			break;
+		case 'R':
+			cfg.write_retries = atoi(optarg);
+			break;
+		case 'i':
+			in_file = optarg;
+			break;
+		case 'o':
+			out_file = optarg;
+			break;
+		case 't':
+			chip_type = fix_chip_type(optarg);
+			if (chip_type < 0) {
+				printf("unknown chip type %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'S':
+			if (sim_parse(&sim, optarg) != 0)
+				return EXIT_FAILURE;
+			simp = &sim;
+			break;
+		case 'F':
+			if (profile_load(optarg, &profiles) != 0)
+				return EXIT_FAILURE;
+			break;
+		case 'M':
+			profile_name = optarg;
+			break;
+		case 'P':
+			cfg.passive = 1;
+			break;
+		case 'X':
+			cfg.raw_patch = 1;
+			break;
+		case 'G':
+			cfg.state_dir = optarg;
+			break;
+		case 'Z':
+			cfg.restore = 1;
+			break;
+		case 'q':
+			cfg.decode_verbose = 0;
+			break;
+		case 'V':
+			cfg.verify_retries = atoi(optarg);
+			break;
+		case 'B':
+			cfg.verify_backoff_ms = atoi(optarg);
+			break;
+		case 'J':
+			if ((cfg.json = open_report(optarg, "a")) == NULL)
+				return EXIT_FAILURE;
+			break;
+		case 'K':
+			if ((cfg.csv = open_report(optarg, "w")) == NULL)
+				return EXIT_FAILURE;
+			break;
+		case 'E':
+			if ((cfg.metrics = metrics_new(optarg)) == NULL)
+				return EXIT_FAILURE;
+			break;
+		case 'U':
+			all = 1;
+			cfg.audit = 1;
+			cfg.dont_write = 1;
+			cfg.passive = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
 	}
-	/* set GROUP3 (BH/BCBUSx slew rate) */
-    ret = ftdi_set_eeprom_value(ftdi, GROUP3_SLEW, SLOW_SLEW);
-	if (ret != 0) {
-		printf("FTDI set GROUP3 slow slew failed: %s\n",
-		       ftdi_get_error_string(ftdi));
-		goto cleanup;
+
+	if ((sel_path || sel_serial) && (all || daemon || simp || sock_path)) {
+		printf("--path and --serial select one USB device: not with "
+		       "-a, -d, --audit, --service nor --sim\n");
+		return EXIT_FAILURE;
 	}
-	/* set INTERFACE_B as UART VCP */
-	ret = ftdi_set_eeprom_value(ftdi, CHANNEL_B_TYPE, CHANNEL_IS_UART);
-	if (ret != 0) {
-		printf("FTDI set InterfaceB as UART failed: %s\n",
-		       ftdi_get_error_string(ftdi));
-		goto cleanup;
+	if (sock_path && (all || daemon || cfg.restore)) {
+		printf("--service: devices are selected by requests, not with "
+		       "-a, -d, --audit nor --restore\n");
+		return EXIT_FAILURE;
 	}
-	ret = ftdi_set_eeprom_value(ftdi, CHANNEL_B_DRIVER, DRIVER_VCP);
-	if (ret != 0) {
-		printf("FTDI set InterfaceB VCP failed: %s\n",
-		       ftdi_get_error_string(ftdi));
-		goto cleanup;
+	if (sel_path && sel_serial) {
+		printf("use either --path or --serial\n");
+		return EXIT_FAILURE;
+	}
+	if (cfg.restore && (cfg.state_dir == NULL || cfg.audit)) {
+		printf("--restore needs --state-dir, and no --audit\n");
+		return EXIT_FAILURE;
 	}
 
-	/* generate new EEPROM */
-	/* my_ftdi_eeprom_build is a modified version */
-	ret = my_ftdi_eeprom_build(ftdi);
-	if (ret < 0) {
-		printf("FTDI EEPROM_build failed: %d %s\n", ret,
-		       ftdi_get_error_string(ftdi));
-		//goto cleanup;
+	cfg.profiles = profiles;
+	if (profile_name &&
+	    (cfg.profile = profile_find(profiles, profile_name)) == NULL) {
+		printf("unknown profile %s\n", profile_name);
+		return EXIT_FAILURE;
 	}
 
-	if (decode_verbose) {
-		/* decode original EEPROM and display details */
-		printf("\n\nNew configuration\n\n");
-		ftdi_eeprom_decode(ftdi, 1);
+	if (in_file) {
+		if (out_file == NULL) {
+			printf("offline mode requires an output file (-o)\n");
+			return EXIT_FAILURE;
+		}
+		ret = fix_file(in_file, out_file, chip_type, &cfg, &res);
+		if (cfg.json)
+			fix_result_json(cfg.json, &res);
+		if (ret == 0)
+			printf("%s: %s -> %s\n", in_file,
+			       fix_status_str(res.status), out_file);
+		return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (simp)
+		printf("%d simulated board(s)\n", simp->count);
+	else
+		printf("vendor %x product %x\n", vendor_id, product_id);
+
+	if (sock_path) {
+		cfg.decode_verbose = 0;
+		ret = service_run(sock_path, sock_mode, vendor_id, product_id,
+				  simp, jobs, &cfg);
+		return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 	}
 
-	if (dont_write == 0) {
-		/* flash the new EEPROM into SPI flash */
-		ret = ftdi_write_eeprom(ftdi);
-		if (ret != 0) {
-			printf("FTDI write EEPROM failed: %d %s\n", ret,
-			       ftdi_get_error_string(ftdi));
-			goto cleanup;
+	if (daemon) {
+		if (simp) {
+			printf("daemon mode needs USB hotplug, not --sim\n");
+			return EXIT_FAILURE;
 		}
+		cfg.decode_verbose = 0;
+		ret = daemon_run(vendor_id, product_id, jobs, &cfg);
+		return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 	}
 
-	libusb_reset_device(ftdi->usb_dev);
-	printf("EEPROM updated\n");
-cleanup:
-	printf("FTDI close: %d\n", ftdi_usb_close(ftdi));
+	if (all) {
+		/* decode dumps from concurrent workers are unreadable */
+		cfg.decode_verbose = 0;
+		ret = fleet_run(vendor_id, product_id, simp, jobs, &cfg);
+		return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (simp == NULL && (ctx = fixft_ctx_new()) == NULL)
+		return EXIT_FAILURE;
+	res.phase_ms[FIX_PHASE_OPEN] = fix_now_ms();
+	sess = open_session(ctx, simp, sel_path, sel_serial, vendor_id,
+			    product_id, &cfg);
+	res.phase_ms[FIX_PHASE_OPEN] = fix_now_ms() - res.phase_ms[FIX_PHASE_OPEN];
+	if (sess == NULL) {
+		res.status = FIX_FAILED;
+		res.ret = -1;
+		snprintf(res.msg, sizeof(res.msg), "open failed");
+		if (cfg.json)
+			fix_result_json(cfg.json, &res);
+		metrics_record(cfg.metrics, &res);
+		fixft_ctx_free(ctx);
+		return EXIT_FAILURE;
+	}
+	fixft_set_config(sess, &cfg);
+
+	if (cmp_read) {
+		ret = compare_read(fixft_dev(sess), cfg.async_window);
+	} else {
+		ret = fixft_fix(sess, &res);
+		if (cfg.json)
+			fix_result_json(cfg.json, &res);
+		metrics_record(cfg.metrics, &res);
+		if (ret == 0 && res.status == FIX_ALREADY_OK)
+			printf("EEPROM already configured\n");
+		else if (ret == 0 && res.status == FIX_NOT_WRITTEN)
+			printf("EEPROM not written\n");
+		else if (ret == 0)
+			printf("EEPROM updated (%d words written)\n",
+			       res.words_written);
+	}
 
-	ftdi_deinit(ftdi);
-	ftdi_free(ftdi);
+	printf("FTDI close: %d\n", fixft_close(sess));
+	fixft_ctx_free(ctx);
 
-	return EXIT_SUCCESS;
+	return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -0,0 +1,219 @@
+/* fleet.c
+ * apply EEPROM fix on all matching devices concurrently
+ *
+ * (C) 2015-2019 by Gwenhael Goavec-Merou <gwen@trabucayre.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <ftdi.h>
+#include <libusb.h>
+#include "fix.h"
+#include "transport.h"
+#include "sim.h"
+#include "metrics.h"
+#include "fleet.h"
+
+struct fleet_target {
+	uint8_t bus;
+	uint8_t addr;
+	int index;		/* simulated board number */
+	struct fix_result res;
+};
+
+struct fleet {
+	struct fleet_target *targets;
+	int nb_targets;
+	int next;
+	pthread_mutex_t lock;
+	const struct fix_config *cfg;
+	const struct sim_config *sim;
+};
+
+/* each worker uses its own context: devices are re-opened by bus/address
+ * inside worker's libusb context
+ */
+static void fleet_fix_one(struct fleet *fl, struct fleet_target *t)
+{
+	struct fix_dev dev;
+	double start = fix_now_ms();
+	int ret;
+
+	if (fl->sim)
+		ret = sim_dev_open(&dev, fl->sim, t->index);
+	else
+		ret = usb_dev_open_bus_addr(&dev, t->bus, t->addr,
+					    fl->cfg->passive);
+	t->res.phase_ms[FIX_PHASE_OPEN] = fix_now_ms() - start;
+	if (ret != 0) {
+		snprintf(t->res.msg, sizeof(t->res.msg), "open failed");
+		t->res.ret = ret;
+		return;
+	}
+
+	fix_device(&dev, fl->cfg, &t->res);
+	fix_dev_close(&dev);
+}
+
+static void *fleet_worker(void *arg)
+{
+	struct fleet *fl = arg;
+	int idx;
+
+	for (;;) {
+		pthread_mutex_lock(&fl->lock);
+		idx = fl->next++;
+		pthread_mutex_unlock(&fl->lock);
+		if (idx >= fl->nb_targets)
+			break;
+		fleet_fix_one(fl, &fl->targets[idx]);
+	}
+	return NULL;
+}
+
+static void fleet_summary(struct fleet *fl, double elapsed)
+{
+	int i, count[FIX_BAD_CHECKSUM + 2] = {0};
+	struct fix_result *res;
+
+	printf("\n%-16s %-20s %-18s %6s %10s  %s\n", "path", "serial",
+	       "status", "words", "time(ms)", "error");
+	if (fl->cfg->csv)
+		fix_result_csv_header(fl->cfg->csv);
+	for (i = 0; i < fl->nb_targets; i++) {
+		res = &fl->targets[i].res;
+		/* FIX_FAILED is -1 */
+		count[res->status + 1]++;
+		printf("%-16s %-20s %-18s %6d %10.1f  %s\n", res->path,
+		       res->serial, fix_status_str(res->status),
+		       res->words_written, res->elapsed_ms, res->msg);
+		if (fl->cfg->json)
+			fix_result_json(fl->cfg->json, res);
+		if (fl->cfg->csv)
+			fix_result_csv(fl->cfg->csv, res);
+		metrics_record(fl->cfg->metrics, res);
+	}
+	if (fl->cfg->audit)
+		printf("%d ok, %d need fix, %d bad checksum\n",
+		       count[FIX_ALREADY_OK + 1], count[FIX_NEEDS_FIX + 1],
+		       count[FIX_BAD_CHECKSUM + 1]);
+	printf("%d device(s), %d failed, %.1f ms\n", fl->nb_targets,
+	       count[FIX_FAILED + 1], elapsed);
+}
+
+static int fleet_find_usb(struct fleet *fl, int vendor_id, int product_id)
+{
+	struct ftdi_context *ftdi;
+	struct ftdi_device_list *devlist, *curdev;
+	int ret, i;
+
+	if ((ftdi = ftdi_new()) == NULL) {
+		printf("FTDI context allocation failed\n");
+		return -1;
+	}
+
+	ret = ftdi_usb_find_all(ftdi, &devlist, vendor_id, product_id);
+	if (ret < 0) {
+		printf("FTDI find all failed: %d %s\n", ret,
+		       ftdi_get_error_string(ftdi));
+		ftdi_free(ftdi);
+		return -1;
+	}
+
+	fl->nb_targets = ret;
+	fl->targets = calloc(ret ? ret : 1, sizeof(struct fleet_target));
+	if (fl->targets == NULL) {
+		ftdi_list_free(&devlist);
+		ftdi_free(ftdi);
+		return -1;
+	}
+	for (i = 0, curdev = devlist; curdev; curdev = curdev->next, i++) {
+		fl->targets[i].bus = libusb_get_bus_number(curdev->dev);
+		fl->targets[i].addr = libusb_get_device_address(curdev->dev);
+		fl->targets[i].res.status = FIX_FAILED;
+		fix_usb_path(curdev->dev, fl->targets[i].res.path,
+			     sizeof(fl->targets[i].res.path));
+	}
+	ftdi_list_free(&devlist);
+	ftdi_free(ftdi);
+	return 0;
+}
+
+static int fleet_find_sim(struct fleet *fl)
+{
+	int i;
+
+	fl->nb_targets = fl->sim->count;
+	fl->targets = calloc(fl->nb_targets, sizeof(struct fleet_target));
+	if (fl->targets == NULL)
+		return -1;
+	for (i = 0; i < fl->nb_targets; i++) {
+		fl->targets[i].index = i;
+		fl->targets[i].res.status = FIX_FAILED;
+		snprintf(fl->targets[i].res.path,
+			 sizeof(fl->targets[i].res.path), "sim-%d", i);
+	}
+	return 0;
+}
+
+int fleet_run(int vendor_id, int product_id, const struct sim_config *sim,
+		int jobs, const struct fix_config *cfg)
+{
+	struct fleet fl;
+	pthread_t *threads;
+	double start = fix_now_ms();
+	int ret, i, failed = 0;
+
+	fl.next = 0;
+	fl.cfg = cfg;
+	fl.sim = sim;
+	if (sim)
+		ret = fleet_find_sim(&fl);
+	else
+		ret = fleet_find_usb(&fl, vendor_id, product_id);
+	if (ret != 0)
+		return -1;
+
+	printf("%d device(s) found\n", fl.nb_targets);
+
+	if (jobs < 1)
+		jobs = 1;
+	if (jobs > fl.nb_targets)
+		jobs = fl.nb_targets;
+
+	pthread_mutex_init(&fl.lock, NULL);
+	threads = calloc(jobs ? jobs : 1, sizeof(pthread_t));
+	for (i = 0; threads && i < jobs; i++) {
+		if (pthread_create(&threads[i], NULL, fleet_worker, &fl) != 0)
+			break;
+	}
+	/* no thread at all: do the work in this one */
+	if (i == 0)
+		fleet_worker(&fl);
+	jobs = i;
+	for (i = 0; i < jobs; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	pthread_mutex_destroy(&fl.lock);
+
+	fleet_summary(&fl, fix_now_ms() - start);
+
+	for (i = 0; i < fl.nb_targets; i++)
+		if (fl.targets[i].res.status == FIX_FAILED)
+			failed++;
+	free(fl.targets);
+
+	return failed;
+}
@@ -0,0 +1,13 @@
+#ifndef FLEET_H_
+#define FLEET_H_
+#include "fix.h"
+
+struct sim_config;
+
+/* fix every vid:pid device found on the host (or every simulated board
+ * when sim is not NULL), with at most jobs devices handled at the same time.
+ * return the number of failed devices or -1 on enumeration error
+ */
+int fleet_run(int vendor_id, int product_id, const struct sim_config *sim,
+		int jobs, const struct fix_config *cfg);
+#endif
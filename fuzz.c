@@ -0,0 +1,444 @@
+/* fuzz.c
+ * compare my_eeprom_build_image() with libftdi ftdi_eeprom_build() on
+ * random field sets, and time both
+ *
+ * (C) 2015-2019 by Gwenhael Goavec-Merou <gwen@trabucayre.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stddef.h>
+#include <getopt.h>
+#include <ftdi.h>
+#include "ftdi_i.h"
+#include "myftdi.h"
+#include "myftdi_layout.h"
+#include "myftdi_image.h"
+#include "fix.h"
+
+#define FUZZ_TYPES (TYPE_230X + 1)
+/* 3 strings up to 240 bytes: every size limit is hit */
+#define FUZZ_STRING_MAX 40
+
+/* one random field set, eeprom strings and user data point into it */
+struct fuzz_case {
+	struct ftdi_eeprom eeprom;	/* buf: content before build */
+	enum ftdi_chip_type type;
+	int intentional;	/* differs on purpose, not timed */
+	char manufacturer[FUZZ_STRING_MAX + 1];
+	char product[FUZZ_STRING_MAX + 1];
+	char serial[FUZZ_STRING_MAX + 1];
+	char user_data[FTDI_MAX_EEPROM_SIZE];
+};
+
+struct fuzz_stats {
+	int cases;
+	int same;
+	int intentional;	/* 2232H/4232H strings in user_area_ext */
+	int mismatch;
+	double ours_ms;
+	double upstream_ms;
+};
+
+/* config field of struct ftdi_eeprom: 0, usual value or up to max */
+struct fuzz_field {
+	short src;
+	int max;
+	int usual;
+};
+
+#define FIELD(name, max, usual) \
+	{ offsetof(struct ftdi_eeprom, name), max, usual }
+
+static const struct fuzz_field fields[] = {
+	FIELD(vendor_id, 0xffff, 0x403),
+	FIELD(product_id, 0xffff, 0x6010),
+	FIELD(self_powered, 1, 1),
+	FIELD(remote_wakeup, 1, 1),
+	FIELD(is_not_pnp, 1, 1),
+	FIELD(suspend_dbus7, 0xff, SUSPEND_DBUS7_BIT),
+	FIELD(in_is_isochronous, 1, 1),
+	FIELD(out_is_isochronous, 1, 1),
+	FIELD(suspend_pull_downs, 1, 1),
+	FIELD(use_serial, 0xff, 1),
+	FIELD(usb_version, 0xffff, 0x200),
+	FIELD(use_usb_version, 1, 1),
+	FIELD(max_power, 600, 500),
+	FIELD(channel_a_type, 0x1f, CHANNEL_IS_FIFO),
+	FIELD(channel_b_type, 0x1f, CHANNEL_IS_FIFO),
+	FIELD(channel_a_driver, 0xff, DRIVER_VCP),
+	FIELD(channel_b_driver, 0xff, DRIVER_VCP),
+	FIELD(channel_c_driver, 0xff, DRIVER_VCP),
+	FIELD(channel_d_driver, 0xff, DRIVER_VCP),
+	FIELD(channel_a_rs485enable, 0xff, CHANNEL_IS_RS485),
+	FIELD(channel_b_rs485enable, 0xff, CHANNEL_IS_RS485),
+	FIELD(channel_c_rs485enable, 0xff, CHANNEL_IS_RS485),
+	FIELD(channel_d_rs485enable, 0xff, CHANNEL_IS_RS485),
+	FIELD(cbus_function[0], 0x1f, 0),
+	FIELD(cbus_function[1], 0x1f, 0),
+	FIELD(cbus_function[2], 0x1f, 0),
+	FIELD(cbus_function[3], 0x1f, 0),
+	FIELD(cbus_function[4], 0x1f, 0),
+	FIELD(cbus_function[5], 0x1f, 0),
+	FIELD(cbus_function[6], 0x1f, 0),
+	FIELD(cbus_function[7], 0x1f, 0),
+	FIELD(cbus_function[8], 0x1f, 0),
+	FIELD(cbus_function[9], 0x1f, 0),
+	FIELD(high_current, 0xff, HIGH_CURRENT_DRIVE_R),
+	FIELD(high_current_a, 0xff, HIGH_CURRENT_DRIVE),
+	FIELD(high_current_b, 0xff, HIGH_CURRENT_DRIVE),
+	FIELD(invert, 0xff, 0),
+	FIELD(external_oscillator, 1, 1),
+	FIELD(group0_drive, 0xff, DRIVE_16MA),
+	FIELD(group0_schmitt, 0xff, IS_SCHMITT),
+	FIELD(group0_slew, 0xff, 1),
+	FIELD(group1_drive, 0xff, DRIVE_16MA),
+	FIELD(group1_schmitt, 0xff, IS_SCHMITT),
+	FIELD(group1_slew, 0xff, 1),
+	FIELD(group2_drive, 0xff, DRIVE_16MA),
+	FIELD(group2_schmitt, 0xff, IS_SCHMITT),
+	FIELD(group2_slew, 0xff, 1),
+	FIELD(group3_drive, 0xff, DRIVE_16MA),
+	FIELD(group3_schmitt, 0xff, IS_SCHMITT),
+	FIELD(group3_slew, 0xff, 1),
+	FIELD(powersave, 0xff, POWER_SAVE_DISABLE_H),
+	FIELD(clock_polarity, 1, 1),
+	FIELD(data_order, 1, 1),
+	FIELD(flow_control, 1, 1),
+	FIELD(release_number, 0xffff, 0x700),
+};
+
+static const char *type_names[FUZZ_TYPES] = {
+	"AM", "BM", "2232C", "R", "2232H", "4232H", "232H", "230X"
+};
+
+static unsigned int fuzz_state;
+
+/* xorshift32: same cases for a seed on every libc */
+static unsigned int fuzz_rand(void)
+{
+	fuzz_state ^= fuzz_state << 13;
+	fuzz_state ^= fuzz_state >> 17;
+	fuzz_state ^= fuzz_state << 5;
+	return fuzz_state;
+}
+
+static int fuzz_pick(int n)
+{
+	return fuzz_rand() % n;
+}
+
+static void usage(const char *name)
+{
+	printf("%s [-N cases] [-r rounds] [-s seed] [-t type] [-v]\n", name);
+	printf("   -N random field sets (default: 10000)\n");
+	printf("   -r timed builds of every field set (default: 20)\n");
+	printf("   -s random seed (default: 1)\n");
+	printf("   -t only this chip type: am, bm, 2232c, r, 2232h, 4232h, "
+	       "232h, 230x\n");
+	printf("   -v show every difference and libftdi warnings\n");
+}
+
+/* enum ftdi_chip_type from name, -1 if unknown */
+static int fuzz_type(const char *name)
+{
+	int i;
+
+	for (i = 0; i < FUZZ_TYPES; i++)
+		if (strcasecmp(name, type_names[i]) == 0)
+			return i;
+	return -1;
+}
+
+/* NULL, or printable characters: mostly short strings fitting in any
+ * EEPROM, up to FUZZ_STRING_MAX
+ */
+static char *fuzz_string(char *s)
+{
+	int i, len;
+
+	if (fuzz_pick(16) == 0)
+		return NULL;
+	len = fuzz_pick((fuzz_pick(4) == 0) ? FUZZ_STRING_MAX + 1 : 17);
+	for (i = 0; i < len; i++)
+		s[i] = ' ' + fuzz_pick(95);
+	s[len] = '\0';
+	return s;
+}
+
+static void fuzz_case_init(struct fuzz_case *c, enum ftdi_chip_type type)
+{
+	static const int sizes[] = { -1, 0x80, 0x100 };
+	static const int chips[] = { 0x46, 0x56, 0x66 };
+	struct ftdi_eeprom *e = &c->eeprom;
+	unsigned int i;
+	int *val;
+
+	memset(c, 0, sizeof(*c));
+	c->type = type;
+	for (i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+		val = (int *)((char *)e + fields[i].src);
+		switch (fuzz_pick(3)) {
+		case 0:
+			*val = 0;
+			break;
+		case 1:
+			*val = fields[i].usual;
+			break;
+		default:
+			*val = fuzz_pick(fields[i].max + 1);
+		}
+	}
+	e->manufacturer = fuzz_string(c->manufacturer);
+	e->product = fuzz_string(c->product);
+	e->serial = fuzz_string(c->serial);
+
+	e->size = sizes[fuzz_pick(3)];
+	e->chip = (fuzz_pick(64) == 0) ? -1 : chips[fuzz_pick(3)];
+	/* previous content: reserved bytes must be kept by both */
+	for (i = 0; i < FTDI_MAX_EEPROM_SIZE; i++)
+		e->buf[i] = fuzz_rand();
+
+	if (fuzz_pick(4) == 0) {
+		for (i = 0; i < sizeof(c->user_data); i++)
+			c->user_data[i] = fuzz_rand();
+		e->user_data = c->user_data;
+		e->user_data_addr = fuzz_pick(FTDI_MAX_EEPROM_SIZE);
+		e->user_data_size = fuzz_pick(48);
+	}
+}
+
+static int fuzz_string_bytes(const struct ftdi_eeprom *e)
+{
+	return ((e->manufacturer ? strlen(e->manufacturer) : 0) +
+		(e->product ? strlen(e->product) : 0) +
+		(e->serial ? strlen(e->serial) : 0)) * 2;
+}
+
+static int fuzz_build_ours(const struct fuzz_case *c, unsigned char *out)
+{
+	struct my_eeprom_build_diag diag;
+
+	memcpy(out, c->eeprom.buf, FTDI_MAX_EEPROM_SIZE);
+	return my_eeprom_build_image(my_ftdi_eeprom_layout(c->type),
+				     &c->eeprom, NULL, out, &diag);
+}
+
+static int fuzz_build_upstream(struct ftdi_context *ftdi,
+		const struct fuzz_case *c)
+{
+	*ftdi->eeprom = c->eeprom;
+	ftdi->type = c->type;
+	return ftdi_eeprom_build(ftdi);
+}
+
+/* compare both builds of c, return 0 when same */
+static int fuzz_compare(struct ftdi_context *ftdi, struct fuzz_case *c,
+		int idx, struct fuzz_stats *st, int verbose)
+{
+	const struct my_eeprom_layout *layout = my_ftdi_eeprom_layout(c->type);
+	unsigned char ours[FTDI_MAX_EEPROM_SIZE];
+	const unsigned char *up = ftdi->eeprom->buf;
+	int ret_ours, ret_up, size, i, nb = 0;
+
+	ret_ours = fuzz_build_ours(c, ours);
+	ret_up = fuzz_build_upstream(ftdi, c);
+	st->cases++;
+
+	/* strings only fitting with the 256 bytes user area */
+	if (ret_up == -1 && ret_ours >= 0 && layout->user_area_ext > 0 &&
+	    fuzz_string_bytes(&c->eeprom) > layout->user_area) {
+		st->intentional++;
+		c->intentional = 1;
+		return 0;
+	}
+	/* free user area returned counts user_area_ext too */
+	if (ret_ours >= 0)
+		ret_ours -= layout->user_area_ext;
+	if (ret_ours != ret_up) {
+		printf("case %d (%s): returned %d, libftdi %d\n", idx,
+		       type_names[c->type], ret_ours, ret_up);
+		st->mismatch++;
+		return 1;
+	}
+	if (ret_ours < 0) {
+		st->same++;
+		return 0;
+	}
+
+	size = ftdi->eeprom->size;
+	for (i = 0; i < FTDI_MAX_EEPROM_SIZE; i++) {
+		/* libftdi reads 230X factory words for the checksum from
+		 * the device, there is none here
+		 */
+		if (c->type == TYPE_230X && (i == size - 2 || i == size - 1))
+			continue;
+		if (ours[i] == up[i])
+			continue;
+		if (nb++ == 0)
+			printf("case %d (%s, size %d):", idx,
+			       type_names[c->type], size);
+		if (nb <= 8 || verbose)
+			printf(" %02x:%02x/%02x", i, ours[i], up[i]);
+	}
+	if (nb == 0) {
+		st->same++;
+		return 0;
+	}
+	printf("%s (addr:ours/libftdi)\n", (nb > 8 && !verbose) ? " ..." : "");
+	st->mismatch++;
+	return 1;
+}
+
+/* builds of every case of type, rounds times, in ms */
+static double fuzz_time(struct ftdi_context *ftdi,
+		const struct fuzz_case *cases, int nb, enum ftdi_chip_type type,
+		int rounds, int upstream)
+{
+	unsigned char out[FTDI_MAX_EEPROM_SIZE];
+	volatile unsigned char sink = 0;
+	double start = fix_now_ms();
+	int r, i;
+
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < nb; i++) {
+			if (cases[i].type != type || cases[i].intentional)
+				continue;
+			if (upstream) {
+				fuzz_build_upstream(ftdi, &cases[i]);
+				sink ^= ftdi->eeprom->buf[0];
+			} else {
+				fuzz_build_ours(&cases[i], out);
+				sink ^= out[0];
+			}
+		}
+	}
+	(void)sink;
+	return fix_now_ms() - start;
+}
+
+static double rate(int builds, double ms)
+{
+	return (ms > 0) ? builds * 1000.0 / ms : 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct fuzz_stats stats[FUZZ_TYPES];
+	struct fuzz_case *cases;
+	struct ftdi_context *ftdi;
+	struct ftdi_eeprom *saved;
+	int nb = 10000, rounds = 20, type = -1, verbose = 0;
+	int c, i, mismatch = 0, builds;
+	unsigned int seed = 1;
+	static const struct option long_options[] = {
+		{"cases", required_argument, 0, 'N'},
+		{"rounds", required_argument, 0, 'r'},
+		{"seed", required_argument, 0, 's'},
+		{"type", required_argument, 0, 't'},
+		{"verbose", no_argument, 0, 'v'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	while ((c = getopt_long(argc, argv, "N:r:s:t:vh", long_options,
+				NULL)) != -1) {
+		switch (c) {
+		case 'N':
+			nb = atoi(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			if ((type = fuzz_type(optarg)) < 0) {
+				printf("unknown chip type %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (nb < 1)
+		nb = 1;
+	if (rounds < 0)
+		rounds = 0;
+	/* xorshift never leaves 0 */
+	fuzz_state = (seed) ? seed : 1;
+
+	/* user data overlap warnings, 230X factory read failures */
+	if (!verbose && freopen("/dev/null", "w", stderr) == NULL)
+		return EXIT_FAILURE;
+
+	if ((cases = calloc(nb, sizeof(*cases))) == NULL ||
+	    (ftdi = ftdi_new()) == NULL) {
+		printf("allocation failed\n");
+		return EXIT_FAILURE;
+	}
+	/* eeprom of ftdi gets the fields of each case */
+	saved = ftdi->eeprom;
+	if ((ftdi->eeprom = malloc(sizeof(*ftdi->eeprom))) == NULL) {
+		printf("allocation failed\n");
+		return EXIT_FAILURE;
+	}
+
+	memset(stats, 0, sizeof(stats));
+	for (i = 0; i < nb; i++) {
+		fuzz_case_init(&cases[i],
+			       (type >= 0) ? type : (i % FUZZ_TYPES));
+		mismatch += fuzz_compare(ftdi, &cases[i], i,
+					 &stats[cases[i].type], verbose);
+	}
+
+	for (i = 0; i < FUZZ_TYPES; i++) {
+		if (stats[i].cases == 0 || rounds == 0)
+			continue;
+		stats[i].ours_ms = fuzz_time(ftdi, cases, nb, i, rounds, 0);
+		stats[i].upstream_ms = fuzz_time(ftdi, cases, nb, i, rounds, 1);
+	}
+
+	printf("\n%-6s %8s %8s %11s %8s %14s %14s\n", "type", "cases",
+	       "same", "intentional", "differ", "builds/s", "libftdi/s");
+	for (i = 0; i < FUZZ_TYPES; i++) {
+		if (stats[i].cases == 0)
+			continue;
+		builds = (stats[i].cases - stats[i].intentional) * rounds;
+		printf("%-6s %8d %8d %11d %8d %14.0f ", type_names[i],
+		       stats[i].cases, stats[i].same, stats[i].intentional,
+		       stats[i].mismatch, rate(builds, stats[i].ours_ms));
+		/* includes the factory reads failing without device */
+		if (i == TYPE_230X)
+			printf("%14s\n", "-");
+		else
+			printf("%14.0f\n", rate(builds, stats[i].upstream_ms));
+	}
+	printf("%d case(s), seed %u, %d differ\n", nb, seed, mismatch);
+
+	/* strings belong to cases, not to libftdi */
+	free(ftdi->eeprom);
+	ftdi->eeprom = saved;
+	ftdi_free(ftdi);
+	free(cases);
+	return (mismatch == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,197 @@
+/* journal.c
+ * resumable EEPROM writes: original and target images kept on disk
+ *
+ * (C) 2015-2019 by Gwenhael Goavec-Merou <gwen@trabucayre.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include "journal.h"
+
+/* file layout: magic, size (16 bits LE), done, restoring, serial, path,
+ * orig[size], target[size]
+ */
+#define JOURNAL_MAGIC "FIXJRNL1"
+#define JOURNAL_EXT ".journal"
+#define JOURNAL_HDR_SIZE (8 + 4 + 64 + 32)
+
+/* serial and path are used in a file name */
+static void journal_name_part(char *out, int len, const char *in)
+{
+	int i;
+
+	if (in[0] == '\0')
+		in = "noserial";
+	for (i = 0; in[i] && i < len - 1; i++)
+		out[i] = (isalnum((unsigned char)in[i]) || in[i] == '-' ||
+			  in[i] == '.' || in[i] == '_') ? in[i] : '_';
+	out[i] = '\0';
+}
+
+static void journal_file(const char *dir, const char *serial,
+		const char *path, char *file, int len)
+{
+	char s[64], p[32];
+
+	journal_name_part(s, sizeof(s), serial);
+	journal_name_part(p, sizeof(p), path);
+	snprintf(file, len, "%s/%s@%s" JOURNAL_EXT, dir, s, p);
+}
+
+/* a rename is only durable once its directory entry is on disk */
+static int journal_sync_dir(const char *dir)
+{
+	int fd, ret;
+
+	if ((fd = open(dir, O_RDONLY | O_DIRECTORY)) < 0)
+		return -1;
+	ret = fsync(fd);
+	close(fd);
+	return ret;
+}
+
+int journal_save(const char *dir, struct fix_journal *j)
+{
+	unsigned char hdr[JOURNAL_HDR_SIZE];
+	char tmp[PATH_MAX + 8];
+	FILE *fd;
+	int ok;
+
+	journal_file(dir, j->serial, j->path, j->file, sizeof(j->file));
+	snprintf(tmp, sizeof(tmp), "%s.tmp", j->file);
+
+	memset(hdr, 0, sizeof(hdr));
+	memcpy(hdr, JOURNAL_MAGIC, 8);
+	hdr[8] = j->size & 0xff;
+	hdr[9] = j->size >> 8;
+	hdr[10] = j->done;
+	hdr[11] = j->restoring;
+	strncpy((char *)hdr + 12, j->serial, 63);
+	strncpy((char *)hdr + 12 + 64, j->path, 31);
+
+	if ((fd = fopen(tmp, "wb")) == NULL) {
+		printf("%s: %s\n", tmp, strerror(errno));
+		return -1;
+	}
+	ok = fwrite(hdr, 1, sizeof(hdr), fd) == sizeof(hdr) &&
+	     fwrite(j->orig, 1, j->size, fd) == (size_t)j->size &&
+	     fwrite(j->target, 1, j->size, fd) == (size_t)j->size &&
+	     fflush(fd) == 0 && fsync(fileno(fd)) == 0;
+	/* journal must be on disk before the first EEPROM word */
+	if (fclose(fd) != 0 || !ok || rename(tmp, j->file) != 0) {
+		printf("%s: %s\n", j->file, strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+	if (journal_sync_dir(dir) != 0) {
+		printf("%s: %s\n", dir, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static int journal_read(const char *file, struct fix_journal *j)
+{
+	unsigned char hdr[JOURNAL_HDR_SIZE];
+	FILE *fd;
+	int ok;
+
+	if ((fd = fopen(file, "rb")) == NULL)
+		return (errno == ENOENT) ? 1 : -1;
+	ok = fread(hdr, 1, sizeof(hdr), fd) == sizeof(hdr) &&
+	     memcmp(hdr, JOURNAL_MAGIC, 8) == 0;
+	if (ok) {
+		j->size = hdr[8] | (hdr[9] << 8);
+		j->done = hdr[10];
+		j->restoring = hdr[11];
+		ok = (j->size == 0x80 || j->size == JOURNAL_MAX_SIZE) &&
+		     fread(j->orig, 1, j->size, fd) == (size_t)j->size &&
+		     fread(j->target, 1, j->size, fd) == (size_t)j->size;
+	}
+	fclose(fd);
+	if (!ok) {
+		printf("%s: invalid journal\n", file);
+		return -1;
+	}
+	memcpy(j->serial, hdr + 12, 63);
+	j->serial[63] = '\0';
+	memcpy(j->path, hdr + 12 + 64, 31);
+	j->path[31] = '\0';
+	snprintf(j->file, sizeof(j->file), "%s", file);
+	return 0;
+}
+
+/* device content is orig, target or a mix of both */
+static int journal_matches(const struct fix_journal *j,
+		const unsigned char *cur)
+{
+	int i;
+
+	for (i = 0; i < j->size; i += 2)
+		if (memcmp(cur + i, j->orig + i, 2) != 0 &&
+		    memcmp(cur + i, j->target + i, 2) != 0)
+			return 0;
+	return 1;
+}
+
+int journal_load(const char *dir, const char *serial, const char *path,
+		const unsigned char *cur, struct fix_journal *j)
+{
+	char file[PATH_MAX], suffix[64], p[32];
+	struct dirent *de;
+	DIR *d;
+	int ret, len, slen;
+
+	if (serial) {
+		journal_file(dir, serial, path, file, sizeof(file));
+		ret = journal_read(file, j);
+		if (ret < 0 || (ret == 0 && journal_matches(j, cur)))
+			return ret;
+	}
+
+	/* serial may be in the half written part: any journal of this path */
+	journal_name_part(p, sizeof(p), path);
+	slen = snprintf(suffix, sizeof(suffix), "@%s" JOURNAL_EXT, p);
+	if ((d = opendir(dir)) == NULL) {
+		printf("%s: %s\n", dir, strerror(errno));
+		return -1;
+	}
+	ret = 1;
+	while (ret != 0 && (de = readdir(d)) != NULL) {
+		len = strlen(de->d_name);
+		if (len <= slen ||
+		    strcmp(de->d_name + len - slen, suffix) != 0)
+			continue;
+		snprintf(file, sizeof(file), "%s/%s", dir, de->d_name);
+		if (journal_read(file, j) == 0 && journal_matches(j, cur))
+			ret = 0;
+	}
+	closedir(d);
+	return ret;
+}
+
+int journal_remove(struct fix_journal *j)
+{
+	if (unlink(j->file) != 0 && errno != ENOENT) {
+		printf("%s: %s\n", j->file, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,33 @@
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+#include <limits.h>
+
+#define JOURNAL_MAX_SIZE 256	/* FTDI_MAX_EEPROM_SIZE */
+
+/* EEPROM write journal of one device: image read before writing and
+ * image being written, saved in a state directory before the first word
+ * is written so an interrupted write can be resumed or undone.
+ * file: <dir>/<serial>@<usb path>.journal
+ */
+struct fix_journal {
+	int size;		/* EEPROM size in bytes */
+	int done;		/* target image written and verified */
+	int restoring;		/* orig being written back: not done */
+	char serial[64];	/* serial read before writing */
+	char path[32];
+	unsigned char orig[JOURNAL_MAX_SIZE];
+	unsigned char target[JOURNAL_MAX_SIZE];
+	char file[PATH_MAX];	/* filled by journal_save/journal_load */
+};
+
+/* write j atomically (temporary file, fsync, rename) */
+int journal_save(const char *dir, struct fix_journal *j);
+/* find journal of device at path whose content cur can come from: every
+ * word of cur is an orig or a target word. serial, when known, is tried
+ * first
+ * return 0 when found, 1 when none, -1 on error
+ */
+int journal_load(const char *dir, const char *serial, const char *path,
+		const unsigned char *cur, struct fix_journal *j);
+int journal_remove(struct fix_journal *j);
+#endif
@@ -0,0 +1,372 @@
+/* libfixft.c
+ * FTDI EEPROM provisioning sessions sharing one libusb context
+ *
+ * (C) 2015-2019 by Gwenhael Goavec-Merou <gwen@trabucayre.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <ftdi.h>
+#include <libusb.h>
+#include "ftdi_i.h"
+#include "myftdi.h"
+#include "transport.h"
+#include "sim.h"
+#include "devindex.h"
+#include "libfixft.h"
+
+/* idle libftdi contexts kept for next sessions, default bound */
+#define FIXFT_POOL_MAX 16
+
+struct fixft_ctx {
+	struct libusb_context *usb;
+	pthread_mutex_t lock;
+	struct ftdi_context **pool;
+	int nb_pool;
+	int max_pool;
+};
+
+struct fixft_session {
+	struct fix_dev dev;
+	struct fixft_ctx *ctx;
+	/* libftdi context on ctx, back to its pool on close (NULL for sim) */
+	struct ftdi_context *shared;
+	struct fix_config cfg;
+	struct fix_result res;	/* verify statistics */
+	unsigned char orig[FTDI_MAX_EEPROM_SIZE];	/* image read */
+};
+
+struct fixft_ctx *fixft_ctx_new(void)
+{
+	struct fixft_ctx *ctx = calloc(1, sizeof(*ctx));
+
+	if (ctx == NULL)
+		return NULL;
+	ctx->max_pool = FIXFT_POOL_MAX;
+	ctx->pool = calloc(ctx->max_pool, sizeof(*ctx->pool));
+	if (ctx->pool == NULL) {
+		free(ctx);
+		return NULL;
+	}
+	if (libusb_init(&ctx->usb) < 0) {
+		printf("libusb init failed\n");
+		free(ctx->pool);
+		free(ctx);
+		return NULL;
+	}
+	pthread_mutex_init(&ctx->lock, NULL);
+	return ctx;
+}
+
+void fixft_ctx_free(struct fixft_ctx *ctx)
+{
+	int i;
+
+	if (ctx == NULL)
+		return;
+	for (i = 0; i < ctx->nb_pool; i++)
+		usb_ftdi_free_shared(ctx->pool[i]);
+	free(ctx->pool);
+	pthread_mutex_destroy(&ctx->lock);
+	libusb_exit(ctx->usb);
+	free(ctx);
+}
+
+/* libftdi context on ctx->usb: a pooled one, else a new one */
+static struct ftdi_context *ctx_ftdi_get(struct fixft_ctx *ctx)
+{
+	struct ftdi_context *ftdi = NULL;
+
+	pthread_mutex_lock(&ctx->lock);
+	if (ctx->nb_pool > 0)
+		ftdi = ctx->pool[--ctx->nb_pool];
+	pthread_mutex_unlock(&ctx->lock);
+	if (ftdi == NULL)
+		ftdi = usb_ftdi_new_shared(ctx->usb);
+	return ftdi;
+}
+
+/* ftdi has no device open anymore */
+static void ctx_ftdi_put(struct fixft_ctx *ctx, struct ftdi_context *ftdi)
+{
+	pthread_mutex_lock(&ctx->lock);
+	if (ctx->nb_pool < ctx->max_pool) {
+		ctx->pool[ctx->nb_pool++] = ftdi;
+		ftdi = NULL;
+	}
+	pthread_mutex_unlock(&ctx->lock);
+	if (ftdi)
+		usb_ftdi_free_shared(ftdi);
+}
+
+int fixft_ctx_reserve(struct fixft_ctx *ctx, int nb)
+{
+	struct ftdi_context **pool, *ftdi;
+	int ret = 0;
+
+	pthread_mutex_lock(&ctx->lock);
+	if (nb > ctx->max_pool) {
+		pool = realloc(ctx->pool, nb * sizeof(*pool));
+		if (pool == NULL) {
+			pthread_mutex_unlock(&ctx->lock);
+			return -1;
+		}
+		ctx->pool = pool;
+		ctx->max_pool = nb;
+	}
+	while (ctx->nb_pool < nb) {
+		if ((ftdi = usb_ftdi_new_shared(ctx->usb)) == NULL) {
+			ret = -1;
+			break;
+		}
+		ctx->pool[ctx->nb_pool++] = ftdi;
+	}
+	pthread_mutex_unlock(&ctx->lock);
+	return ret;
+}
+
+static struct fixft_session *session_new(void)
+{
+	struct fixft_session *s = calloc(1, sizeof(*s));
+
+	if (s == NULL)
+		return NULL;
+	/* same defaults as the command line tool */
+	s->cfg.write_retries = 2;
+	s->cfg.verify_retries = 3;
+	s->cfg.verify_backoff_ms = 10;
+	return s;
+}
+
+static struct fixft_session *session_open(struct fixft_ctx *ctx,
+		struct libusb_device *udev, int passive)
+{
+	struct fixft_session *s;
+
+	if ((s = session_new()) == NULL)
+		return NULL;
+	s->cfg.passive = passive;
+	s->ctx = ctx;
+	if ((s->shared = ctx_ftdi_get(ctx)) == NULL ||
+	    usb_dev_open_device(&s->dev, s->shared, udev, passive) != 0) {
+		if (s->shared)
+			ctx_ftdi_put(ctx, s->shared);
+		free(s);
+		return NULL;
+	}
+	return s;
+}
+
+/* open first device of ctx for which match() is true */
+static struct fixft_session *session_find(struct fixft_ctx *ctx,
+		int (*match)(struct libusb_device *udev, int a, int b),
+		int a, int b, int passive)
+{
+	struct fixft_session *s = NULL;
+	libusb_device **devs;
+	ssize_t nb, i;
+
+	if ((nb = libusb_get_device_list(ctx->usb, &devs)) < 0) {
+		printf("libusb_get_device_list() failed\n");
+		return NULL;
+	}
+	for (i = 0; i < nb; i++) {
+		if (match(devs[i], a, b)) {
+			s = session_open(ctx, devs[i], passive);
+			break;
+		}
+	}
+	if (i == nb)
+		printf("device not found\n");
+	libusb_free_device_list(devs, 1);
+	return s;
+}
+
+static int match_ids(struct libusb_device *udev, int vendor_id,
+		int product_id)
+{
+	struct libusb_device_descriptor desc;
+
+	return libusb_get_device_descriptor(udev, &desc) == 0 &&
+	       desc.idVendor == vendor_id && desc.idProduct == product_id;
+}
+
+static int match_bus_addr(struct libusb_device *udev, int bus, int addr)
+{
+	return libusb_get_bus_number(udev) == bus &&
+	       libusb_get_device_address(udev) == addr;
+}
+
+struct fixft_session *fixft_open(struct fixft_ctx *ctx, int vendor_id,
+		int product_id, int passive)
+{
+	return session_find(ctx, match_ids, vendor_id, product_id, passive);
+}
+
+struct fixft_session *fixft_open_bus_addr(struct fixft_ctx *ctx, int bus,
+		int addr, int passive)
+{
+	return session_find(ctx, match_bus_addr, bus, addr, passive);
+}
+
+struct fixft_session *fixft_open_path(struct fixft_ctx *ctx,
+		const char *path, int passive)
+{
+	struct usb_devinfo info;
+
+	if (devindex_by_path(path, &info) != 0) {
+		printf("%s: no such device\n", path);
+		return NULL;
+	}
+	return fixft_open_bus_addr(ctx, info.bus, info.addr, passive);
+}
+
+struct fixft_session *fixft_open_serial(struct fixft_ctx *ctx,
+		const char *serial, int vendor_id, int product_id,
+		const char *index, int passive)
+{
+	struct usb_devinfo info;
+
+	if (devindex_by_serial(index, serial, vendor_id, product_id,
+			       &info) != 0) {
+		printf("%s: no such device\n", serial);
+		return NULL;
+	}
+	return fixft_open_bus_addr(ctx, info.bus, info.addr, passive);
+}
+
+struct fixft_session *fixft_open_sim(const struct sim_config *sim,
+		int index)
+{
+	struct fixft_session *s;
+
+	if ((s = session_new()) == NULL)
+		return NULL;
+	if (sim_dev_open(&s->dev, sim, index) != 0) {
+		free(s);
+		return NULL;
+	}
+	return s;
+}
+
+int fixft_close(struct fixft_session *s)
+{
+	int ret;
+
+	if (s == NULL)
+		return 0;
+	ret = fix_dev_close(&s->dev);
+	if (s->shared)
+		ctx_ftdi_put(s->ctx, s->shared);
+	free(s);
+	return ret;
+}
+
+void fixft_set_config(struct fixft_session *s, const struct fix_config *cfg)
+{
+	s->cfg = *cfg;
+}
+
+int fixft_read(struct fixft_session *s)
+{
+	int ret;
+
+	ret = s->dev.ops->read_eeprom(&s->dev, s->cfg.async_window);
+	if (ret == 0)
+		memcpy(s->orig, s->dev.ftdi->eeprom->buf, FTDI_MAX_EEPROM_SIZE);
+	return ret;
+}
+
+const struct board_profile *fixft_decode(struct fixft_session *s,
+		const struct board_profile *profiles)
+{
+	if (ftdi_eeprom_decode(s->dev.ftdi, 0) != 0)
+		return NULL;
+	return (profiles) ? profile_match(profiles, s->dev.ftdi) :
+			    profile_builtin();
+}
+
+int fixft_apply_profile(struct fixft_session *s,
+		const struct board_profile *prof)
+{
+	const struct profile_patch *failed;
+
+	return profile_apply(prof, s->dev.ftdi, &failed);
+}
+
+int fixft_build(struct fixft_session *s)
+{
+	return my_ftdi_eeprom_build(s->dev.ftdi);
+}
+
+int fixft_diff(struct fixft_session *s, unsigned char *changed)
+{
+	unsigned char tmp[FTDI_MAX_EEPROM_SIZE / 2];
+
+	return my_ftdi_eeprom_diff(s->dev.ftdi, s->orig,
+				   (changed) ? changed : tmp);
+}
+
+int fixft_write(struct fixft_session *s)
+{
+	return s->dev.ops->write_eeprom(&s->dev, s->orig,
+					s->cfg.async_window,
+					s->cfg.write_delay_us,
+					s->cfg.write_retries);
+}
+
+int fixft_verify(struct fixft_session *s)
+{
+	return fix_verify(&s->dev, &s->cfg, s->orig, &s->res);
+}
+
+int fixft_reset(struct fixft_session *s)
+{
+	return s->dev.ops->reset(&s->dev);
+}
+
+int fixft_fix(struct fixft_session *s, struct fix_result *res)
+{
+	return fix_device(&s->dev, &s->cfg, res);
+}
+
+int fixft_flash(struct fixft_session *s, const unsigned char *image,
+		int size, struct fix_result *res)
+{
+	return fix_image(&s->dev, &s->cfg, image, size, res);
+}
+
+const unsigned char *fixft_image(struct fixft_session *s, int *size)
+{
+	if (size)
+		*size = s->dev.ftdi->eeprom->size;
+	return s->dev.ftdi->eeprom->buf;
+}
+
+const char *fixft_path(struct fixft_session *s)
+{
+	return s->dev.path;
+}
+
+const char *fixft_error(struct fixft_session *s)
+{
+	return ftdi_get_error_string(s->dev.ftdi);
+}
+
+struct fix_dev *fixft_dev(struct fixft_session *s)
+{
+	return &s->dev;
+}
@@ -0,0 +1,101 @@
+#ifndef LIBFIXFT_H_
+#define LIBFIXFT_H_
+#include "fix.h"
+#include "profile.h"
+
+/* libfixft: provisioning of FTDI EEPROMs from another program
+ *
+ * One context holds the libusb context shared by every session; each
+ * session owns one device and a libftdi context taken from a pool of
+ * the context (reused from closed sessions), so sessions can be
+ * driven from different threads at the same time (a session itself is
+ * not to be used by two threads at once).
+ *
+ * Step by step use:
+ *	ctx = fixft_ctx_new();
+ *	s = fixft_open_path(ctx, "1-3.4", 1);
+ *	fixft_read(s);
+ *	prof = fixft_decode(s, profiles);
+ *	fixft_apply_profile(s, prof);
+ *	fixft_build(s);
+ *	if (fixft_diff(s, NULL) > 0) {
+ *		fixft_write(s);
+ *		fixft_verify(s);
+ *		fixft_reset(s);
+ *	}
+ *	fixft_close(s);
+ *	fixft_ctx_free(ctx);
+ * or the whole flow, as the command line tool does: fixft_fix().
+ * Functions returning int return < 0 on error, see fixft_error().
+ */
+
+struct fixft_ctx;
+struct fixft_session;
+struct sim_config;
+
+struct fixft_ctx *fixft_ctx_new(void);
+/* every session of ctx must be closed first */
+void fixft_ctx_free(struct fixft_ctx *ctx);
+/* keep nb libftdi contexts ready for sessions (default: up to 16 kept
+ * from closed sessions), ie. one per thread opening sessions
+ */
+int fixft_ctx_reserve(struct fixft_ctx *ctx, int nb);
+
+/* passive: keep kernel driver, don't claim interface (see --no-detach) */
+struct fixft_session *fixft_open(struct fixft_ctx *ctx, int vendor_id,
+		int product_id, int passive);
+struct fixft_session *fixft_open_bus_addr(struct fixft_ctx *ctx, int bus,
+		int addr, int passive);
+/* topology path (1-3.4) or bus:addr */
+struct fixft_session *fixft_open_path(struct fixft_ctx *ctx,
+		const char *path, int passive);
+/* index: serial -> path cache file, may be NULL */
+struct fixft_session *fixft_open_serial(struct fixft_ctx *ctx,
+		const char *serial, int vendor_id, int product_id,
+		const char *index, int passive);
+/* simulated board, ctx not needed */
+struct fixft_session *fixft_open_sim(const struct sim_config *sim,
+		int index);
+int fixft_close(struct fixft_session *s);
+
+/* transfer tuning and flow options (write retries, journal...), the
+ * session keeps a copy. default: blocking transfers, 2 write retries,
+ * 3 verify rounds
+ */
+void fixft_set_config(struct fixft_session *s, const struct fix_config *cfg);
+
+int fixft_read(struct fixft_session *s);
+/* decode image read, return the profile matching the device: first of
+ * profiles, else the built-in one. NULL when none matches
+ */
+const struct board_profile *fixft_decode(struct fixft_session *s,
+		const struct board_profile *profiles);
+int fixft_apply_profile(struct fixft_session *s,
+		const struct board_profile *prof);
+int fixft_build(struct fixft_session *s);
+/* words of built image differing from image read, changed (may be NULL)
+ * gets one flag per word
+ */
+int fixft_diff(struct fixft_session *s, unsigned char *changed);
+/* write differing words, return number of words written */
+int fixft_write(struct fixft_session *s);
+/* read back and rewrite mismatched words, 0 when device matches */
+int fixft_verify(struct fixft_session *s);
+int fixft_reset(struct fixft_session *s);
+
+/* read, patch, build, write, verify and reset in one call */
+int fixft_fix(struct fixft_session *s, struct fix_result *res);
+/* read, write words of image (size bytes, same size as the EEPROM,
+ * valid checksum) which differ, verify and reset. journaled when the
+ * configuration has a state directory
+ */
+int fixft_flash(struct fixft_session *s, const unsigned char *image,
+		int size, struct fix_result *res);
+
+/* current image (read or built) and its size */
+const unsigned char *fixft_image(struct fixft_session *s, int *size);
+const char *fixft_path(struct fixft_session *s);
+const char *fixft_error(struct fixft_session *s);
+/* lower level access for tools sharing the transport layer */
+struct fix_dev *fixft_dev(struct fixft_session *s);
+#endif
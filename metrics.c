@@ -0,0 +1,342 @@
+/* metrics.c
+ * Prometheus text format export of device runs
+ *
+ * (C) 2015-2019 by Gwenhael Goavec-Merou <gwen@trabucayre.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "fix.h"
+#include "metrics.h"
+
+/* bounded label sets: a flapping link must not grow the file forever */
+#define METRICS_MAX_ERRORS 32
+#define METRICS_MAX_HUBS 64
+#define METRICS_STATUS_NR (FIX_BAD_CHECKSUM + 2)	/* FIX_FAILED is -1 */
+
+/* phase latency buckets, in seconds */
+static const double buckets[] = {
+	0.001, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+};
+#define METRICS_BUCKETS (sizeof(buckets) / sizeof(buckets[0]))
+
+struct metrics_hist {
+	unsigned long count[METRICS_BUCKETS];	/* not cumulative */
+	unsigned long total;
+	double sum;
+};
+
+struct metrics_label {
+	char name[128];
+	unsigned long runs;
+	unsigned long failed;
+	unsigned long retries;
+};
+
+struct metrics {
+	pthread_mutex_t lock;
+	char file[PATH_MAX];
+	unsigned long runs[METRICS_STATUS_NR];
+	unsigned long words_written;
+	unsigned long bytes_changed;
+	unsigned long transfers;
+	unsigned long retries;
+	unsigned long failures;
+	unsigned long verify_rounds;
+	unsigned long resets;
+	struct metrics_hist phase[FIX_PHASE_NR];
+	/* last entry of errors and hubs: other */
+	struct metrics_label errors[METRICS_MAX_ERRORS + 1];
+	int nb_errors;
+	struct metrics_label hubs[METRICS_MAX_HUBS + 1];
+	int nb_hubs;
+	time_t last_run;
+};
+
+/* entry of name in table, last one (other) when table is full */
+static struct metrics_label *metrics_label(struct metrics_label *tab,
+		int *nb, int max, const char *name)
+{
+	int i;
+
+	for (i = 0; i < *nb; i++)
+		if (strcmp(tab[i].name, name) == 0)
+			return &tab[i];
+	if (*nb == max) {
+		snprintf(tab[max].name, sizeof(tab[max].name), "other");
+		return &tab[max];
+	}
+	snprintf(tab[*nb].name, sizeof(tab[*nb].name), "%s", name);
+	return &tab[(*nb)++];
+}
+
+/* hub a device hangs on: path without its last port (1-2.4 -> 1-2),
+ * root hub of the bus for a device on a root port (1-2 -> usb1)
+ */
+static void metrics_hub(const char *path, char *hub, int len)
+{
+	const char *dot = strrchr(path, '.');
+	const char *dash = strchr(path, '-');
+
+	if (path[0] == '\0')
+		snprintf(hub, len, "unknown");
+	else if (strncmp(path, "sim-", 4) == 0)
+		snprintf(hub, len, "sim");
+	else if (dot)
+		snprintf(hub, len, "%.*s", (int)(dot - path), path);
+	else if (dash)
+		snprintf(hub, len, "usb%.*s", (int)(dash - path), path);
+	else
+		snprintf(hub, len, "%s", path);
+}
+
+static void metrics_hist_add(struct metrics_hist *h, double sec)
+{
+	unsigned int i;
+
+	for (i = 0; i < METRICS_BUCKETS && sec > buckets[i]; i++)
+		;
+	if (i < METRICS_BUCKETS)
+		h->count[i]++;
+	h->total++;
+	h->sum += sec;
+}
+
+/* label value: backslash, double quote and new line escaped */
+static void metrics_string(FILE *fd, const char *s)
+{
+	for (; *s; s++) {
+		if (*s == '\\' || *s == '"')
+			fprintf(fd, "\\%c", *s);
+		else if (*s == '\n')
+			fputs("\\n", fd);
+		else
+			fputc(*s, fd);
+	}
+}
+
+static void metrics_head(FILE *fd, const char *name, const char *type,
+		const char *help)
+{
+	fprintf(fd, "# HELP fixft_%s %s\n# TYPE fixft_%s %s\n", name, help,
+		name, type);
+}
+
+static void metrics_counter(FILE *fd, const char *name, const char *help,
+		unsigned long val)
+{
+	metrics_head(fd, name, "counter", help);
+	fprintf(fd, "fixft_%s %lu\n", name, val);
+}
+
+static void metrics_labels(FILE *fd, const char *name, const char *label,
+		const struct metrics_label *tab, int nb,
+		unsigned long (*val)(const struct metrics_label *l))
+{
+	int i;
+
+	for (i = 0; i < nb; i++) {
+		fprintf(fd, "fixft_%s{%s=\"", name, label);
+		metrics_string(fd, tab[i].name);
+		fprintf(fd, "\"} %lu\n", val(&tab[i]));
+	}
+}
+
+static unsigned long label_runs(const struct metrics_label *l)
+{
+	return l->runs;
+}
+
+static unsigned long label_failed(const struct metrics_label *l)
+{
+	return l->failed;
+}
+
+static unsigned long label_retries(const struct metrics_label *l)
+{
+	return l->retries;
+}
+
+static void metrics_dump(struct metrics *m, FILE *fd)
+{
+	static const char *status[METRICS_STATUS_NR] = {
+		"failed", "updated", "not_written", "already_configured",
+		"needs_fix", "bad_checksum"
+	};
+	unsigned long cumul, total = 0;
+	unsigned int i, b;
+	int nb;
+
+	for (i = 0; i < METRICS_STATUS_NR; i++)
+		total += m->runs[i];
+	metrics_counter(fd, "devices_total", "Devices handled.", total);
+	metrics_head(fd, "runs_total", "counter",
+		     "Devices handled by outcome.");
+	for (i = 0; i < METRICS_STATUS_NR; i++)
+		fprintf(fd, "fixft_runs_total{status=\"%s\"} %lu\n",
+			status[i], m->runs[i]);
+	metrics_counter(fd, "words_written_total", "EEPROM words written.",
+			m->words_written);
+	metrics_counter(fd, "bytes_changed_total",
+			"EEPROM bytes differing from the target image.",
+			m->bytes_changed);
+	metrics_counter(fd, "transfers_total", "USB control transfers issued.",
+			m->transfers);
+	metrics_counter(fd, "transfer_retries_total",
+			"USB control transfers issued again.", m->retries);
+	metrics_counter(fd, "transfer_failures_total",
+			"USB control transfers failed.", m->failures);
+	metrics_counter(fd, "verify_rewrites_total",
+			"Verify rounds rewriting mismatched words.",
+			m->verify_rounds);
+	metrics_counter(fd, "resets_total", "Devices reset.", m->resets);
+
+	nb = m->nb_errors + (m->errors[METRICS_MAX_ERRORS].runs > 0);
+	metrics_head(fd, "failures_total", "counter",
+		     "Failed devices by error string.");
+	metrics_labels(fd, "failures_total", "error", m->errors, nb,
+		       label_runs);
+
+	nb = m->nb_hubs + (m->hubs[METRICS_MAX_HUBS].runs > 0);
+	metrics_head(fd, "hub_devices_total", "counter",
+		     "Devices handled by parent hub.");
+	metrics_labels(fd, "hub_devices_total", "hub", m->hubs, nb,
+		       label_runs);
+	metrics_head(fd, "hub_failures_total", "counter",
+		     "Failed devices by parent hub.");
+	metrics_labels(fd, "hub_failures_total", "hub", m->hubs, nb,
+		       label_failed);
+	metrics_head(fd, "hub_transfer_retries_total", "counter",
+		     "USB control transfers issued again by parent hub.");
+	metrics_labels(fd, "hub_transfer_retries_total", "hub", m->hubs, nb,
+		       label_retries);
+
+	metrics_head(fd, "phase_duration_seconds", "histogram",
+		     "Time spent in each step of a device run.");
+	for (i = 0; i < FIX_PHASE_NR; i++) {
+		const struct metrics_hist *h = &m->phase[i];
+		const char *name = fix_phase_str(i);
+
+		for (b = 0, cumul = 0; b < METRICS_BUCKETS; b++) {
+			cumul += h->count[b];
+			fprintf(fd, "fixft_phase_duration_seconds_bucket"
+				"{phase=\"%s\",le=\"%g\"} %lu\n", name,
+				buckets[b], cumul);
+		}
+		fprintf(fd, "fixft_phase_duration_seconds_bucket"
+			"{phase=\"%s\",le=\"+Inf\"} %lu\n", name, h->total);
+		fprintf(fd, "fixft_phase_duration_seconds_sum{phase=\"%s\"} "
+			"%.6f\n", name, h->sum);
+		fprintf(fd, "fixft_phase_duration_seconds_count{phase=\"%s\"} "
+			"%lu\n", name, h->total);
+	}
+
+	metrics_head(fd, "last_run_timestamp_seconds", "gauge",
+		     "Time of the last device run.");
+	fprintf(fd, "fixft_last_run_timestamp_seconds %ld\n",
+		(long)m->last_run);
+}
+
+/* temporary file then rename: a scraper never reads a partial file */
+static int metrics_write(struct metrics *m)
+{
+	char tmp[PATH_MAX + 8];
+	FILE *fd;
+	int ok;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", m->file);
+	if ((fd = fopen(tmp, "w")) == NULL) {
+		printf("%s: %s\n", tmp, strerror(errno));
+		return -1;
+	}
+	metrics_dump(m, fd);
+	ok = !ferror(fd);
+	if (fclose(fd) != 0 || !ok || rename(tmp, m->file) != 0) {
+		printf("%s: %s\n", m->file, strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+struct metrics *metrics_new(const char *file)
+{
+	struct metrics *m = calloc(1, sizeof(*m));
+
+	if (m == NULL)
+		return NULL;
+	snprintf(m->file, sizeof(m->file), "%s", file);
+	pthread_mutex_init(&m->lock, NULL);
+	/* zeroed counters from start, so rates begin at the first run */
+	if (metrics_write(m) != 0) {
+		metrics_free(m);
+		return NULL;
+	}
+	return m;
+}
+
+void metrics_free(struct metrics *m)
+{
+	if (m == NULL)
+		return;
+	pthread_mutex_destroy(&m->lock);
+	free(m);
+}
+
+void metrics_record(struct metrics *m, const struct fix_result *res)
+{
+	struct metrics_label *hub, *err;
+	char name[32];
+	int i;
+
+	if (m == NULL)
+		return;
+	metrics_hub(res->path, name, sizeof(name));
+
+	pthread_mutex_lock(&m->lock);
+	if (res->status >= FIX_FAILED && res->status <= FIX_BAD_CHECKSUM)
+		m->runs[res->status + 1]++;
+	m->words_written += res->words_written;
+	m->bytes_changed += res->bytes_changed;
+	m->transfers += res->transfers;
+	m->retries += res->retries;
+	m->failures += res->failures;
+	m->verify_rounds += res->verify_rounds;
+	m->resets += res->reset;
+	/* a phase not reached is not a 0 s sample */
+	for (i = 0; i < FIX_PHASE_NR; i++)
+		if (res->phase_ms[i] > 0)
+			metrics_hist_add(&m->phase[i],
+					 res->phase_ms[i] / 1000.0);
+
+	hub = metrics_label(m->hubs, &m->nb_hubs, METRICS_MAX_HUBS, name);
+	hub->runs++;
+	hub->retries += res->retries;
+	if (res->status == FIX_FAILED) {
+		hub->failed++;
+		err = metrics_label(m->errors, &m->nb_errors,
+				    METRICS_MAX_ERRORS,
+				    res->msg[0] ? res->msg : "unknown");
+		err->runs++;
+	}
+	m->last_run = time(NULL);
+	metrics_write(m);
+	pthread_mutex_unlock(&m->lock);
+}
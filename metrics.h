@@ -0,0 +1,16 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+#include "fix.h"
+
+/* counters and phase latency histograms of device runs, exported in
+ * Prometheus text format to a file (node_exporter textfile collector),
+ * rewritten atomically after every run
+ */
+struct metrics;
+
+/* NULL when file can't be written */
+struct metrics *metrics_new(const char *file);
+void metrics_free(struct metrics *m);
+/* account one device run and rewrite the file, thread safe */
+void metrics_record(struct metrics *m, const struct fix_result *res);
+#endif
@@ -7,125 +7,62 @@
 #include "ftdi_i.h"
 #include <ftdi.h>
 #include "myftdi.h"
-
-#define ftdi_error_return(code, str) do {  \
-        if ( ftdi )                        \
-            ftdi->error_str = str;         \
-        else                               \
-            fprintf(stderr, str);          \
-        return code;                       \
-   } while(0);
-
-
+#include "myftdi_layout.h"
+#include "myftdi_image.h"
 
 /* Based on official libftdi 1.4 implementation */
 
-/*FTD2XX doesn't check for values not fitting in the ACBUS Signal options*/
-void set_ft232h_cbus(struct ftdi_eeprom *eeprom, unsigned char * output)
-{
-    int i;
-    for(i=0; i<5; i++)
-    {
-        int mode_low, mode_high;
-        if (eeprom->cbus_function[2*i]> CBUSH_CLK7_5)
-            mode_low = CBUSH_TRISTATE;
-        else
-            mode_low = eeprom->cbus_function[2*i];
-        if (eeprom->cbus_function[2*i+1]> CBUSH_CLK7_5)
-            mode_high = CBUSH_TRISTATE;
-        else
-            mode_high = eeprom->cbus_function[2*i+1];
-
-        output[0x18+i] = (mode_high <<4) | mode_low;
-    }
-}
-/* Return the bits for the encoded EEPROM Structure of a requested Mode
- *
- */
-static unsigned char type2bit(unsigned char type, enum ftdi_chip_type chip)
-{
-    switch (chip)
-    {
-        case TYPE_2232H:
-        case TYPE_2232C:
-        {
-            switch (type)
-            {
-                case CHANNEL_IS_UART: return 0;
-                case CHANNEL_IS_FIFO: return 0x01;
-                case CHANNEL_IS_OPTO: return 0x02;
-                case CHANNEL_IS_CPU : return 0x04;
-                default: return 0;
-            }
-        }
-        case TYPE_232H:
-        {
-            switch (type)
-            {
-                case CHANNEL_IS_UART   : return 0;
-                case CHANNEL_IS_FIFO   : return 0x01;
-                case CHANNEL_IS_OPTO   : return 0x02;
-                case CHANNEL_IS_CPU    : return 0x04;
-                case CHANNEL_IS_FT1284 : return 0x08;
-                default: return 0;
-            }
-        }
-        case TYPE_R:
-        {
-            switch (type)
-            {
-                case CHANNEL_IS_UART   : return 0;
-                case CHANNEL_IS_FIFO   : return 0x01;
-                default: return 0;
-            }
-        }
-        case TYPE_230X: /* FT230X is only UART */
-        default: return 0;
-    }
-    return 0;
-}
+/* set diagnostic error string and return */
+#define build_error_return(code, str) do { \
+        diag->error = str;                 \
+        return code;                       \
+   } while (0)
 
 /**
-    Build binary buffer from ftdi_eeprom structure.
-    Output is suitable for ftdi_write_eeprom().
+    Build binary buffer from field values, without any device access nor
+    output: safe to run concurrently on many images.
 
-    \param ftdi pointer to ftdi_context
+    \param layout chip layout, see my_ftdi_eeprom_layout()
+    \param eeprom field values, strings and user data. eeprom->size -1
+           means size guessed from eeprom->chip
+    \param factory layout factory words (FT230X), read once from the
+           device. NULL: taken from image (MTP read)
+    \param image built image, reserved bytes of layout are kept
+    \param diag size, user area size, warnings and error string
 
     \retval >=0: size of eeprom user area in bytes
     \retval -1: eeprom size (128 bytes) exceeded by custom strings
-    \retval -2: Invalid eeprom or ftdi pointer
-    \retval -3: Invalid cbus function setting     (FIXME: Not in the code?)
-    \retval -4: Chip doesn't support invert       (FIXME: Not in the code?)
-    \retval -5: Chip doesn't support high current drive         (FIXME: Not in the code?)
-    \retval -6: No connected EEPROM or EEPROM Type unknown
+    \retval -2: Invalid eeprom pointer
+    \retval -6: No connected EEPROM, EEPROM or chip type unknown
 */
-int my_ftdi_eeprom_build(struct ftdi_context *ftdi)
+int my_eeprom_build_image(const struct my_eeprom_layout *layout,
+        const struct ftdi_eeprom *eeprom, const unsigned short *factory,
+        unsigned char *output, struct my_eeprom_build_diag *diag)
 {
+    struct my_eeprom_image img;
     unsigned char i, j, eeprom_size_mask;
-    unsigned short checksum, value;
     unsigned char manufacturer_size = 0, product_size = 0, serial_size = 0;
-    int user_area_size, free_start, free_end;
-    struct ftdi_eeprom *eeprom;
-    unsigned char * output;
+    int user_area_size, free_start, free_end, size;
 
-    if (ftdi == NULL)
-        ftdi_error_return(-2,"No context");
-    if (ftdi->eeprom == NULL)
-        ftdi_error_return(-2,"No eeprom structure");
+    memset(diag, 0, sizeof(*diag));
 
-    eeprom= ftdi->eeprom;
-    output = eeprom->buf;
+    if (layout == NULL)
+        build_error_return(-6,"Unknown chip type");
+    if (eeprom == NULL)
+        build_error_return(-2,"No eeprom structure");
 
     if (eeprom->chip == -1)
-        ftdi_error_return(-6,"No connected EEPROM or EEPROM type unknown");
+        build_error_return(-6,"No connected EEPROM or EEPROM type unknown");
 
-    if (eeprom->size == -1)
+    size = eeprom->size;
+    if (size == -1)
     {
         if ((eeprom->chip == 0x56) || (eeprom->chip == 0x66))
-            eeprom->size = 0x100;
+            size = 0x100;
         else
-            eeprom->size = 0x80;
+            size = 0x80;
     }
+    diag->size = size;
 
     if (eeprom->manufacturer != NULL)
         manufacturer_size = strlen(eeprom->manufacturer);
@@ -135,123 +72,32 @@ int my_ftdi_eeprom_build(struct ftdi_context *ftdi)
         serial_size = strlen(eeprom->serial);
 
     // eeprom size check
-    switch (ftdi->type)
-    {
-        case TYPE_AM:
-        case TYPE_BM:
-        case TYPE_R:
-            user_area_size = 96;    // base size for strings (total of 48 characters)
-            break;
-        case TYPE_2232C:
-            user_area_size = 90;     // two extra config bytes and 4 bytes PnP stuff
-            break;
-        case TYPE_230X:
-            user_area_size = 88;     // four extra config bytes + 4 bytes PnP stuff
-            break;
-        case TYPE_2232H:            // six extra config bytes + 4 bytes PnP stuff
-        case TYPE_4232H:
-            user_area_size = 86;
-			user_area_size += 128;
-            break;
-        case TYPE_232H:
-            user_area_size = 80;
-            break;
-        default:
-            user_area_size = 0;
-            break;
-    }
+    user_area_size = layout->user_area + layout->user_area_ext;
     user_area_size  -= (manufacturer_size + product_size + serial_size) * 2;
+    diag->user_area_size = user_area_size;
 
     if (user_area_size < 0)
-        ftdi_error_return(-1,"eeprom size exceeded");
+        build_error_return(-1,"eeprom size exceeded");
 
-    // empty eeprom
-    if (ftdi->type == TYPE_230X)
+    // empty eeprom, reserved bytes are left untouched
+    if (layout->keep_end > layout->keep_start)
     {
-        /* FT230X have a reserved section in the middle of the MTP,
-           which cannot be written to, but must be included in the checksum */
-        memset(ftdi->eeprom->buf, 0, 0x80);
-        memset((ftdi->eeprom->buf + 0xa0), 0, (FTDI_MAX_EEPROM_SIZE - 0xa0));
+        memset(output, 0, layout->keep_start);
+        memset(output + layout->keep_end, 0,
+               FTDI_MAX_EEPROM_SIZE - layout->keep_end);
     }
     else
     {
-        memset(ftdi->eeprom->buf, 0, FTDI_MAX_EEPROM_SIZE);
+        memset(output, 0, FTDI_MAX_EEPROM_SIZE);
     }
 
-    // Bytes and Bits set for all Types
-
-    // Addr 02: Vendor ID
-    output[0x02] = eeprom->vendor_id;
-    output[0x03] = eeprom->vendor_id >> 8;
-
-    // Addr 04: Product ID
-    output[0x04] = eeprom->product_id;
-    output[0x05] = eeprom->product_id >> 8;
-
-    // Addr 06: Device release number (0400h for BM features)
-    output[0x06] = eeprom->release_number;
-    output[0x07] = eeprom->release_number >> 8;
-
-    // Addr 08: Config descriptor
-    // Bit 7: always 1
-    // Bit 6: 1 if this device is self powered, 0 if bus powered
-    // Bit 5: 1 if this device uses remote wakeup
-    // Bit 4-0: reserved - 0
-    j = 0x80;
-    if (eeprom->self_powered)
-        j |= 0x40;
-    if (eeprom->remote_wakeup)
-        j |= 0x20;
-    output[0x08] = j;
-
-    // Addr 09: Max power consumption: max power = value * 2 mA
-    output[0x09] = eeprom->max_power / MAX_POWER_MILLIAMP_PER_UNIT;
-
-    if ((ftdi->type != TYPE_AM) && (ftdi->type != TYPE_230X))
-    {
-        // Addr 0A: Chip configuration
-        // Bit 7: 0 - reserved
-        // Bit 6: 0 - reserved
-        // Bit 5: 0 - reserved
-        // Bit 4: 1 - Change USB version
-        // Bit 3: 1 - Use the serial number string
-        // Bit 2: 1 - Enable suspend pull downs for lower power
-        // Bit 1: 1 - Out EndPoint is Isochronous
-        // Bit 0: 1 - In EndPoint is Isochronous
-        //
-        j = 0;
-        if (eeprom->in_is_isochronous)
-            j = j | 1;
-        if (eeprom->out_is_isochronous)
-            j = j | 2;
-        output[0x0A] = j;
-    }
+    // Bytes and Bits written before strings
+    my_ftdi_eeprom_encode(layout->head, layout->nb_head, eeprom, output);
 
     // Dynamic content
-    // Strings start at 0x94 (TYPE_AM, TYPE_BM)
-    // 0x96 (TYPE_2232C), 0x98 (TYPE_R) and 0x9a (TYPE_x232H)
-    // 0xa0 (TYPE_232H)
-    i = 0;
-    switch (ftdi->type)
-    {
-        case TYPE_2232H:
-        case TYPE_4232H:
-            i += 2;
-        case TYPE_R:
-            i += 2;
-        case TYPE_2232C:
-            i += 2;
-        case TYPE_AM:
-        case TYPE_BM:
-            i += 0x94;
-            break;
-        case TYPE_232H:
-        case TYPE_230X:
-            i = 0xa0;
-            break;
-    }
+    i = layout->string_start;
     /* Wrap around 0x80 for 128 byte EEPROMS (Internale and 93x46) */
-    eeprom_size_mask = eeprom->size -1;
+    eeprom_size_mask = size -1;
     free_end = i & eeprom_size_mask;
 
     // Addr 0E: Offset of the manufacturer string + 0x80, calculated later
@@ -291,7 +137,7 @@ int my_ftdi_eeprom_build(struct ftdi_context *ftdi)
     }
 
     // Legacy port name and PnP fields for FT2232 and newer chips
-    if (ftdi->type > TYPE_BM)
+    if (layout->pnp)
     {
         output[i & eeprom_size_mask] = 0x02; /* as seen when written with FTD2XX */
         i++;
@@ -303,379 +149,377 @@ int my_ftdi_eeprom_build(struct ftdi_context *ftdi)
 
     output[0x13] = serial_size*2 + 2;
 
-    if (ftdi->type > TYPE_AM) /* use_serial not used in AM devices */
-    {
-        if (eeprom->use_serial)
-            output[0x0A] |= USE_SERIAL_NUM;
-        else
-            output[0x0A] &= ~USE_SERIAL_NUM;
-    }
-
-    /* Bytes and Bits specific to (some) types
-       Write linear, as this allows easier fixing*/
-    switch (ftdi->type)
-    {
-        case TYPE_AM:
-            break;
-        case TYPE_BM:
-            output[0x0C] = eeprom->usb_version & 0xff;
-            output[0x0D] = (eeprom->usb_version>>8) & 0xff;
-            if (eeprom->use_usb_version)
-                output[0x0A] |= USE_USB_VERSION_BIT;
-            else
-                output[0x0A] &= ~USE_USB_VERSION_BIT;
-
-            break;
-        case TYPE_2232C:
-
-            output[0x00] = type2bit(eeprom->channel_a_type, TYPE_2232C);
-            if ( eeprom->channel_a_driver == DRIVER_VCP)
-                output[0x00] |= DRIVER_VCP;
-            else
-                output[0x00] &= ~DRIVER_VCP;
-
-            if ( eeprom->high_current_a == HIGH_CURRENT_DRIVE)
-                output[0x00] |= HIGH_CURRENT_DRIVE;
-            else
-                output[0x00] &= ~HIGH_CURRENT_DRIVE;
-
-            output[0x01] = type2bit(eeprom->channel_b_type, TYPE_2232C);
-            if ( eeprom->channel_b_driver == DRIVER_VCP)
-                output[0x01] |= DRIVER_VCP;
-            else
-                output[0x01] &= ~DRIVER_VCP;
-
-            if ( eeprom->high_current_b == HIGH_CURRENT_DRIVE)
-                output[0x01] |= HIGH_CURRENT_DRIVE;
-            else
-                output[0x01] &= ~HIGH_CURRENT_DRIVE;
-
-            if (eeprom->in_is_isochronous)
-                output[0x0A] |= 0x1;
-            else
-                output[0x0A] &= ~0x1;
-            if (eeprom->out_is_isochronous)
-                output[0x0A] |= 0x2;
-            else
-                output[0x0A] &= ~0x2;
-            if (eeprom->suspend_pull_downs)
-                output[0x0A] |= 0x4;
-            else
-                output[0x0A] &= ~0x4;
-            if (eeprom->use_usb_version)
-                output[0x0A] |= USE_USB_VERSION_BIT;
-            else
-                output[0x0A] &= ~USE_USB_VERSION_BIT;
-
-            output[0x0C] = eeprom->usb_version & 0xff;
-            output[0x0D] = (eeprom->usb_version>>8) & 0xff;
-            output[0x14] = eeprom->chip;
-            break;
-        case TYPE_R:
-            output[0x00] = type2bit(eeprom->channel_a_type, TYPE_R);
-            if (eeprom->high_current == HIGH_CURRENT_DRIVE_R)
-                output[0x00] |= HIGH_CURRENT_DRIVE_R;
-            if (eeprom->external_oscillator)
-                output[0x00] |= 0x02;
-            output[0x01] = 0x40; /* Hard coded Endpoint Size*/
-
-            if (eeprom->suspend_pull_downs)
-                output[0x0A] |= 0x4;
-            else
-                output[0x0A] &= ~0x4;
-            output[0x0B] = eeprom->invert;
-            output[0x0C] = eeprom->usb_version & 0xff;
-            output[0x0D] = (eeprom->usb_version>>8) & 0xff;
-
-            if (eeprom->cbus_function[0] > CBUS_BB_RD)
-                output[0x14] = CBUS_TXLED;
-            else
-                output[0x14] = eeprom->cbus_function[0];
-
-            if (eeprom->cbus_function[1] > CBUS_BB_RD)
-                output[0x14] |= CBUS_RXLED<<4;
-            else
-                output[0x14] |= eeprom->cbus_function[1]<<4;
-
-            if (eeprom->cbus_function[2] > CBUS_BB_RD)
-                output[0x15] = CBUS_TXDEN;
-            else
-                output[0x15] = eeprom->cbus_function[2];
-
-            if (eeprom->cbus_function[3] > CBUS_BB_RD)
-                output[0x15] |= CBUS_PWREN<<4;
-            else
-                output[0x15] |= eeprom->cbus_function[3]<<4;
-
-            if (eeprom->cbus_function[4] > CBUS_CLK6)
-                output[0x16] = CBUS_SLEEP;
-            else
-                output[0x16] = eeprom->cbus_function[4];
-            break;
-        case TYPE_2232H:
-            output[0x00] = type2bit(eeprom->channel_a_type, TYPE_2232H);
-            if ( eeprom->channel_a_driver == DRIVER_VCP)
-                output[0x00] |= DRIVER_VCP;
-            else
-                output[0x00] &= ~DRIVER_VCP;
-
-            output[0x01] = type2bit(eeprom->channel_b_type, TYPE_2232H);
-            if ( eeprom->channel_b_driver == DRIVER_VCP)
-                output[0x01] |= DRIVER_VCP;
-            else
-                output[0x01] &= ~DRIVER_VCP;
-            if (eeprom->suspend_dbus7 == SUSPEND_DBUS7_BIT)
-                output[0x01] |= SUSPEND_DBUS7_BIT;
-            else
-                output[0x01] &= ~SUSPEND_DBUS7_BIT;
-
-            if (eeprom->suspend_pull_downs)
-                output[0x0A] |= 0x4;
-            else
-                output[0x0A] &= ~0x4;
-
-            if (eeprom->group0_drive > DRIVE_16MA)
-                output[0x0c] |= DRIVE_16MA;
-            else
-                output[0x0c] |= eeprom->group0_drive;
-            if (eeprom->group0_schmitt == IS_SCHMITT)
-                output[0x0c] |= IS_SCHMITT;
-            if (eeprom->group0_slew == SLOW_SLEW)
-                output[0x0c] |= SLOW_SLEW;
-
-            if (eeprom->group1_drive > DRIVE_16MA)
-                output[0x0c] |= DRIVE_16MA<<4;
-            else
-                output[0x0c] |= eeprom->group1_drive<<4;
-            if (eeprom->group1_schmitt == IS_SCHMITT)
-                output[0x0c] |= IS_SCHMITT<<4;
-            if (eeprom->group1_slew == SLOW_SLEW)
-                output[0x0c] |= SLOW_SLEW<<4;
-
-            if (eeprom->group2_drive > DRIVE_16MA)
-                output[0x0d] |= DRIVE_16MA;
-            else
-                output[0x0d] |= eeprom->group2_drive;
-            if (eeprom->group2_schmitt == IS_SCHMITT)
-                output[0x0d] |= IS_SCHMITT;
-            if (eeprom->group2_slew == SLOW_SLEW)
-                output[0x0d] |= SLOW_SLEW;
-
-            if (eeprom->group3_drive > DRIVE_16MA)
-                output[0x0d] |= DRIVE_16MA<<4;
-            else
-                output[0x0d] |= eeprom->group3_drive<<4;
-            if (eeprom->group3_schmitt == IS_SCHMITT)
-                output[0x0d] |= IS_SCHMITT<<4;
-            if (eeprom->group3_slew == SLOW_SLEW)
-                output[0x0d] |= SLOW_SLEW<<4;
-
-            output[0x18] = eeprom->chip;
-
-            break;
-        case TYPE_4232H:
-            if (eeprom->channel_a_driver == DRIVER_VCP)
-                output[0x00] |= DRIVER_VCP;
-            else
-                output[0x00] &= ~DRIVER_VCP;
-            if (eeprom->channel_b_driver == DRIVER_VCP)
-                output[0x01] |= DRIVER_VCP;
-            else
-                output[0x01] &= ~DRIVER_VCP;
-            if (eeprom->channel_c_driver == DRIVER_VCP)
-                output[0x00] |= (DRIVER_VCP << 4);
-            else
-                output[0x00] &= ~(DRIVER_VCP << 4);
-            if (eeprom->channel_d_driver == DRIVER_VCP)
-                output[0x01] |= (DRIVER_VCP << 4);
-            else
-                output[0x01] &= ~(DRIVER_VCP << 4);
-
-            if (eeprom->suspend_pull_downs)
-                output[0x0a] |= 0x4;
-            else
-                output[0x0a] &= ~0x4;
-
-            if (eeprom->channel_a_rs485enable)
-                output[0x0b] |= CHANNEL_IS_RS485 << 0;
-            else
-                output[0x0b] &= ~(CHANNEL_IS_RS485 << 0);
-            if (eeprom->channel_b_rs485enable)
-                output[0x0b] |= CHANNEL_IS_RS485 << 1;
-            else
-                output[0x0b] &= ~(CHANNEL_IS_RS485 << 1);
-            if (eeprom->channel_c_rs485enable)
-                output[0x0b] |= CHANNEL_IS_RS485 << 2;
-            else
-                output[0x0b] &= ~(CHANNEL_IS_RS485 << 2);
-            if (eeprom->channel_d_rs485enable)
-                output[0x0b] |= CHANNEL_IS_RS485 << 3;
-            else
-                output[0x0b] &= ~(CHANNEL_IS_RS485 << 3);
-
-            if (eeprom->group0_drive > DRIVE_16MA)
-                output[0x0c] |= DRIVE_16MA;
-            else
-                output[0x0c] |= eeprom->group0_drive;
-            if (eeprom->group0_schmitt == IS_SCHMITT)
-                output[0x0c] |= IS_SCHMITT;
-            if (eeprom->group0_slew == SLOW_SLEW)
-                output[0x0c] |= SLOW_SLEW;
-
-            if (eeprom->group1_drive > DRIVE_16MA)
-                output[0x0c] |= DRIVE_16MA<<4;
-            else
-                output[0x0c] |= eeprom->group1_drive<<4;
-            if (eeprom->group1_schmitt == IS_SCHMITT)
-                output[0x0c] |= IS_SCHMITT<<4;
-            if (eeprom->group1_slew == SLOW_SLEW)
-                output[0x0c] |= SLOW_SLEW<<4;
-
-            if (eeprom->group2_drive > DRIVE_16MA)
-                output[0x0d] |= DRIVE_16MA;
-            else
-                output[0x0d] |= eeprom->group2_drive;
-            if (eeprom->group2_schmitt == IS_SCHMITT)
-                output[0x0d] |= IS_SCHMITT;
-            if (eeprom->group2_slew == SLOW_SLEW)
-                output[0x0d] |= SLOW_SLEW;
-
-            if (eeprom->group3_drive > DRIVE_16MA)
-                output[0x0d] |= DRIVE_16MA<<4;
-            else
-                output[0x0d] |= eeprom->group3_drive<<4;
-            if (eeprom->group3_schmitt == IS_SCHMITT)
-                output[0x0d] |= IS_SCHMITT<<4;
-            if (eeprom->group3_slew == SLOW_SLEW)
-                output[0x0d] |= SLOW_SLEW<<4;
-
-            output[0x18] = eeprom->chip;
-
-            break;
-        case TYPE_232H:
-            output[0x00] = type2bit(eeprom->channel_a_type, TYPE_232H);
-            if ( eeprom->channel_a_driver == DRIVER_VCP)
-                output[0x00] |= DRIVER_VCPH;
-            else
-                output[0x00] &= ~DRIVER_VCPH;
-            if (eeprom->powersave)
-                output[0x01] |= POWER_SAVE_DISABLE_H;
-            else
-                output[0x01] &= ~POWER_SAVE_DISABLE_H;
-
-            if (eeprom->suspend_pull_downs)
-                output[0x0a] |= 0x4;
-            else
-                output[0x0a] &= ~0x4;
-
-            if (eeprom->clock_polarity)
-                output[0x01] |= FT1284_CLK_IDLE_STATE;
-            else
-                output[0x01] &= ~FT1284_CLK_IDLE_STATE;
-            if (eeprom->data_order)
-                output[0x01] |= FT1284_DATA_LSB;
-            else
-                output[0x01] &= ~FT1284_DATA_LSB;
-            if (eeprom->flow_control)
-                output[0x01] |= FT1284_FLOW_CONTROL;
-            else
-                output[0x01] &= ~FT1284_FLOW_CONTROL;
-            if (eeprom->group0_drive > DRIVE_16MA)
-                output[0x0c] |= DRIVE_16MA;
-            else
-                output[0x0c] |= eeprom->group0_drive;
-            if (eeprom->group0_schmitt == IS_SCHMITT)
-                output[0x0c] |= IS_SCHMITT;
-            if (eeprom->group0_slew == SLOW_SLEW)
-                output[0x0c] |= SLOW_SLEW;
-
-            if (eeprom->group1_drive > DRIVE_16MA)
-                output[0x0d] |= DRIVE_16MA;
-            else
-                output[0x0d] |= eeprom->group1_drive;
-            if (eeprom->group1_schmitt == IS_SCHMITT)
-                output[0x0d] |= IS_SCHMITT;
-            if (eeprom->group1_slew == SLOW_SLEW)
-                output[0x0d] |= SLOW_SLEW;
-
-            set_ft232h_cbus(eeprom, output);
-
-            output[0x1e] = eeprom->chip;
-            fprintf(stderr,"FIXME: Build FT232H specific EEPROM settings\n");
-            break;
-        case TYPE_230X:
-            output[0x00] = 0x80; /* Actually, leave the default value */
-            /*FIXME: Make DBUS & CBUS Control configurable*/
-            output[0x0c] = 0;    /* DBUS drive 4mA, CBUS drive 4 mA like factory default */
-            for (j = 0; j <= 6; j++)
-            {
-                output[0x1a + j] = eeprom->cbus_function[j];
-            }
-            output[0x0b] = eeprom->invert;
-            break;
-    }
+    /* Bytes and Bits specific to (some) types, see myftdi_layout.c */
+    my_ftdi_eeprom_encode(layout->fields, layout->nb_fields, eeprom, output);
 
     /* First address without use */
-    free_start = 0;
-    switch (ftdi->type)
-    {
-        case TYPE_230X:
-            free_start += 2;
-        case TYPE_232H:
-            free_start += 6;
-        case TYPE_2232H:
-        case TYPE_4232H:
-            free_start += 2;
-        case TYPE_R:
-            free_start += 2;
-        case TYPE_2232C:
-            free_start++;
-        case TYPE_AM:
-        case TYPE_BM:
-            free_start += 0x14;
-    }
+    free_start = layout->free_start;
 
     /* Arbitrary user data */
     if (eeprom->user_data && eeprom->user_data_size >= 0)
     {
         if (eeprom->user_data_addr < free_start)
-            fprintf(stderr,"Warning, user data starts inside the generated data!\n");
+            diag->warnings |= MY_BUILD_WARN_USER_DATA_CONFIG;
         if (eeprom->user_data_addr + eeprom->user_data_size >= free_end)
-            fprintf(stderr,"Warning, user data overlaps the strings area!\n");
-        if (eeprom->user_data_addr + eeprom->user_data_size > eeprom->size)
-            ftdi_error_return(-1,"eeprom size exceeded");
+            diag->warnings |= MY_BUILD_WARN_USER_DATA_STRINGS;
+        if (eeprom->user_data_addr + eeprom->user_data_size > size)
+            build_error_return(-1,"eeprom size exceeded");
         memcpy(output + eeprom->user_data_addr, eeprom->user_data, eeprom->user_data_size);
     }
 
     // calculate checksum
-    checksum = 0xAAAA;
+    if (factory == NULL && layout->factory_end > layout->factory_start)
+        diag->warnings |= MY_BUILD_WARN_FACTORY;
+    my_eeprom_image_init(&img, layout, output, size, factory);
+    output[size-2] = img.checksum;
+    output[size-1] = img.checksum >> 8;
+
+    return user_area_size;
+}
+
+/**
+    Read factory words of layout from device.
+
+    \param ftdi pointer to ftdi_context
+    \param layout chip layout
+    \param factory filled with layout->factory_end - layout->factory_start
+           words
+
+    \retval 0: all words read (or layout without factory data)
+    \retval -1: read failed
+*/
+int my_ftdi_read_factory(struct ftdi_context *ftdi,
+        const struct my_eeprom_layout *layout, unsigned short *factory)
+{
+    int i;
+
+    for (i = layout->factory_start; i < layout->factory_end; i++)
+    {
+        if (ftdi_read_eeprom_location(ftdi, i,
+                                      &factory[i - layout->factory_start]))
+            return -1;
+    }
+    return 0;
+}
+
+/**
+    Build binary buffer from ftdi_eeprom structure.
+    Output is suitable for ftdi_write_eeprom().
+
+    Wrapper of my_eeprom_build_image(): reads factory data from the device
+    when the chip has some, displays warnings and sets ftdi error string.
+
+    \param ftdi pointer to ftdi_context
+
+    \retval >=0: size of eeprom user area in bytes
+    \retval -1: eeprom size (128 bytes) exceeded by custom strings
+    \retval -2: Invalid eeprom or ftdi pointer
+    \retval -6: No connected EEPROM or EEPROM Type unknown
+*/
+int my_ftdi_eeprom_build(struct ftdi_context *ftdi)
+{
+    const struct my_eeprom_layout *layout;
+    struct my_eeprom_build_diag diag;
+    unsigned short factory[MY_IMAGE_WORDS];
+    const unsigned short *factoryp = NULL;
+    int ret;
+
+    if (ftdi == NULL)
+        ftdi_error_return(-2,"No context");
+    if (ftdi->eeprom == NULL)
+        ftdi_error_return(-2,"No eeprom structure");
 
-    for (i = 0; i < eeprom->size/2-1; i++)
+    layout = my_ftdi_eeprom_layout(ftdi->type);
+    if (layout != NULL && layout->factory_end > layout->factory_start &&
+        ftdi->eeprom->chip != -1)
     {
-        if ((ftdi->type == TYPE_230X) && (i == 0x12))
+        if (my_ftdi_read_factory(ftdi, layout, factory) == 0)
+            factoryp = factory;
+        else
+            fprintf(stderr, "Reading Factory Configuration Data failed\n");
+    }
+
+    ret = my_eeprom_build_image(layout, ftdi->eeprom, factoryp,
+                                ftdi->eeprom->buf, &diag);
+    if (diag.warnings & MY_BUILD_WARN_USER_DATA_CONFIG)
+        fprintf(stderr,"Warning, user data starts inside the generated data!\n");
+    if (diag.warnings & MY_BUILD_WARN_USER_DATA_STRINGS)
+        fprintf(stderr,"Warning, user data overlaps the strings area!\n");
+    if (diag.size)
+        ftdi->eeprom->size = diag.size;
+    if (ret < 0)
+        ftdi_error_return(ret, diag.error);
+
+    ftdi->eeprom->initialized_for_connected_device = 1;
+    return ret;
+}
+
+
+/* string descriptor at offset/length bytes addr, addr + 1 of buf, same
+ * decoding as ftdi_eeprom_decode()
+ */
+static char *raw_string(const unsigned char *buf, int size, int addr)
+{
+    int i, j, len = buf[addr + 1] / 2;
+    char *str;
+
+    if (len <= 0 || (str = malloc(len)) == NULL)
+        return NULL;
+    i = buf[addr] & (size - 1);
+    for (j = 0; j < len - 1; j++)
+        str[j] = buf[(2*j + i + 2) & (size - 1)];
+    str[j] = '\0';
+    return str;
+}
+
+/**
+    Fill IDs and strings of ftdi->eeprom from eeprom->buf without a full
+    decode: enough to identify the device and select a board profile.
+
+    \param ftdi pointer to ftdi_context with eeprom->buf and size set
+
+    \retval 0: all went well
+    \retval -1: unknown EEPROM size
+*/
+int my_ftdi_eeprom_raw_ids(struct ftdi_context *ftdi)
+{
+    struct ftdi_eeprom *eeprom = ftdi->eeprom;
+    unsigned char *buf = eeprom->buf;
+
+    if (eeprom->size <= 0)
+        ftdi_error_return(-1, "unknown EEPROM size");
+
+    eeprom->vendor_id = buf[0x02] | (buf[0x03] << 8);
+    eeprom->product_id = buf[0x04] | (buf[0x05] << 8);
+
+    free(eeprom->manufacturer);
+    free(eeprom->product);
+    free(eeprom->serial);
+    eeprom->manufacturer = raw_string(buf, eeprom->size, 0x0E);
+    eeprom->product = raw_string(buf, eeprom->size, 0x10);
+    eeprom->serial = raw_string(buf, eeprom->size, 0x12);
+    return 0;
+}
+
+/**
+    Guess EEPROM size from its content, same guess as ftdi_read_eeprom().
+
+    \param ftdi pointer to ftdi_context with eeprom->buf filled
+*/
+void my_ftdi_eeprom_guess_size(struct ftdi_context *ftdi)
+{
+    unsigned char *buf = ftdi->eeprom->buf;
+
+    if (ftdi->type == TYPE_R)
+        ftdi->eeprom->size = 0x80;
+    /*    Guesses size of eeprom by comparing halves
+          - will not work with blank eeprom */
+    else if (strrchr((const char *)buf, 0xff) == ((const char *)buf +FTDI_MAX_EEPROM_SIZE -1))
+        ftdi->eeprom->size = -1;
+    else if (memcmp(buf,&buf[0x80],0x80) == 0)
+        ftdi->eeprom->size = 0x80;
+    else if (memcmp(buf,&buf[0x40],0x40) == 0)
+        ftdi->eeprom->size = 0x40;
+    else
+        ftdi->eeprom->size = 0x100;
+}
+
+/* words compared with their alias 128 bytes above: VID, PID, release
+ * and checksum word of a 128 bytes EEPROM
+ */
+static const unsigned char probe_words[MY_FTDI_PROBE_WORDS] = {1, 2, 3, 63};
+
+/**
+    Address of the i-th word to read to probe EEPROM size.
+
+    \param ftdi pointer to ftdi_context
+    \param i probe word, 0 to MY_FTDI_PROBE_WORDS - 1
+
+    \retval word address
+    \retval -1: size given by chip type, no probe
+*/
+int my_ftdi_eeprom_probe_addr(struct ftdi_context *ftdi, int i)
+{
+    if (ftdi->type == TYPE_R || ftdi->type == TYPE_230X)
+        return -1;
+    return 0x80/2 + probe_words[i];
+}
+
+/**
+    Detect EEPROM size from address aliasing: a 93C46 ignores the upper
+    address bit, so words read 128 bytes above are the lower ones.
+    When the EEPROM is 128 bytes, eeprom->size is set and the upper half
+    of eeprom->buf is filled as a full read would do.
+
+    \param ftdi pointer to ftdi_context, lower 128 bytes of eeprom->buf
+           filled
+    \param probe words read at my_ftdi_eeprom_probe_addr(), NULL when
+           they could not be read
+
+    \retval 0x80: EEPROM is 128 bytes, nothing more to read
+    \retval -1: size unknown, whole EEPROM has to be read
+*/
+int my_ftdi_eeprom_probe_size(struct ftdi_context *ftdi,
+                              const unsigned short *probe)
+{
+    unsigned char *buf = ftdi->eeprom->buf;
+    int i, addr, blank = 1;
+
+    if (ftdi->type == TYPE_230X)
+        return -1;
+    if (ftdi->type != TYPE_R)
+    {
+        if (probe == NULL)
+            return -1;
+        /* blank EEPROM: every word matches */
+        for (i = 0; i < 0x80 && blank; i++)
+            blank = (buf[i] == 0xff);
+        if (blank)
+            return -1;
+        for (i = 0; i < MY_FTDI_PROBE_WORDS; i++)
         {
-            /* FT230X has a user section in the MTP which is not part of the checksum */
-            i = 0x40;
+            addr = probe_words[i] * 2;
+            if (probe[i] != (buf[addr] | (buf[addr + 1] << 8)))
+                return -1;
         }
-        if ((ftdi->type == TYPE_230X) && (i >=  0x40) && (i < 0x50)) {
-            uint16_t data;
-            if (ftdi_read_eeprom_location(ftdi, i, &data)) {
-                fprintf(stderr, "Reading Factory Configuration Data failed\n");
-                i = 0x50;
-            }
-            value = data;
-        }
-        else {
-            value = output[i*2];
-            value += output[(i*2)+1] << 8;
+    }
+
+    memcpy(buf + 0x80, buf, 0x80);
+    ftdi->eeprom->size = 0x80;
+    return 0x80;
+}
+
+/**
+    Mark words of eeprom->buf which differ from orig (image previously
+    read from the device).
+
+    \param ftdi pointer to ftdi_context
+    \param orig EEPROM content as read before build
+    \param changed FTDI_MAX_EEPROM_SIZE/2 flags, set to 1 for modified words
+
+    \retval number of modified words
+*/
+int my_ftdi_eeprom_diff(struct ftdi_context *ftdi, const unsigned char *orig,
+                        unsigned char *changed)
+{
+    unsigned char *eeprom = ftdi->eeprom->buf;
+    int i, nb_changed = 0;
+
+    memset(changed, 0, FTDI_MAX_EEPROM_SIZE/2);
+    for (i = 0; i < ftdi->eeprom->size/2; i++)
+    {
+        /* Do not try to write to reserved area */
+        if ((ftdi->type == TYPE_230X) && (i >= 0x40) && (i < 0x50))
+            continue;
+        changed[i] = (eeprom[i*2] != orig[i*2]) ||
+                     (eeprom[i*2+1] != orig[i*2+1]);
+        nb_changed += changed[i];
+    }
+    return nb_changed;
+}
+
+/**
+    Prepare device before EEPROM write, as done by ftdi_write_eeprom().
+
+    \param ftdi pointer to ftdi_context
+
+    \retval  0: all fine
+    \retval <0: libftdi error code
+*/
+int my_ftdi_write_prepare(struct ftdi_context *ftdi,
+                          struct my_ftdi_stats *stats)
+{
+    unsigned short status;
+    int ret;
+
+    if (ftdi == NULL || ftdi->usb_dev == NULL)
+        ftdi_error_return(-2, "USB device unavailable");
+
+    if (ftdi->eeprom->initialized_for_connected_device == 0)
+        ftdi_error_return(-3, "EEPROM not initialized for the connected device");
+
+    /* These commands were traced while running MProg */
+    my_ftdi_stats_add(stats, transfers, 3);
+    if ((ret = ftdi_usb_reset(ftdi)) != 0 ||
+        (ret = ftdi_poll_modem_status(ftdi, &status)) != 0 ||
+        (ret = ftdi_set_latency_timer(ftdi, 0x77)) != 0)
+    {
+        my_ftdi_stats_add(stats, failures, 1);
+        return ret;
+    }
+    return 0;
+}
+
+/**
+    Write only words of eeprom->buf which differ from orig (image
+    previously read from the device) and read them back.
+    Based on ftdi_write_eeprom(): ftdi_write_eeprom_location() can't be
+    used, it rejects the checksum protected area below 0x80.
+
+    \param ftdi pointer to ftdi_context
+    \param orig EEPROM content as read before build
+    \param stats transfer counters, may be NULL
+
+    \retval >=0: number of words written
+    \retval -1: write failed
+    \retval -2: USB device unavailable
+    \retval -3: EEPROM not initialized for the connected device
+    \retval -4: read back failed
+    \retval -5: read back mismatch
+*/
+int my_ftdi_write_eeprom_diff(struct ftdi_context *ftdi,
+                              const unsigned char *orig,
+                              struct my_ftdi_stats *stats)
+{
+    unsigned short usb_val;
+    int i, ret, nb_words, nb_changed;
+    unsigned char *eeprom;
+    unsigned char changed[FTDI_MAX_EEPROM_SIZE/2];
+
+    if (ftdi == NULL || ftdi->usb_dev == NULL)
+        ftdi_error_return(-2, "USB device unavailable");
+
+    eeprom = ftdi->eeprom->buf;
+    nb_words = ftdi->eeprom->size/2;
+
+    nb_changed = my_ftdi_eeprom_diff(ftdi, orig, changed);
+    if (nb_changed == 0)
+        return 0;
+
+    if ((ret = my_ftdi_write_prepare(ftdi, stats)) != 0)
+        return ret;
+
+    /* ascending order: checksum word is the last one written */
+    for (i = 0; i < nb_words; i++)
+    {
+        if (!changed[i])
+            continue;
+        usb_val = eeprom[i*2];
+        usb_val += eeprom[(i*2)+1] << 8;
+        my_ftdi_stats_add(stats, transfers, 1);
+        if (libusb_control_transfer(ftdi->usb_dev, FTDI_DEVICE_OUT_REQTYPE,
+                                    SIO_WRITE_EEPROM_REQUEST, usb_val, i,
+                                    NULL, 0, ftdi->usb_write_timeout) < 0)
+        {
+            my_ftdi_stats_add(stats, failures, 1);
+            ftdi_error_return(-1, "unable to write eeprom");
         }
-        checksum = value^checksum;
-        checksum = (checksum << 1) | (checksum >> 15);
     }
 
-    output[eeprom->size-2] = checksum;
-    output[eeprom->size-1] = checksum >> 8;
+    /* verify only written words */
+    for (i = 0; i < nb_words; i++)
+    {
+        if (!changed[i])
+            continue;
+        my_ftdi_stats_add(stats, transfers, 1);
+        if (ftdi_read_eeprom_location(ftdi, i, &usb_val))
+        {
+            my_ftdi_stats_add(stats, failures, 1);
+            ftdi_error_return(-4, "eeprom read back failed");
+        }
+        if (usb_val != (eeprom[i*2] | (eeprom[(i*2)+1] << 8)))
+            ftdi_error_return(-5, "eeprom read back mismatch");
+    }
 
-    eeprom->initialized_for_connected_device = 1;
-    return user_area_size;
+    return nb_changed;
 }
@@ -1,6 +1,50 @@
 #ifndef MY_FTDI_H_
 #define MY_FTDI_H_
+#include <stdio.h>
 #include <ftdi.h>
 
+/* same helper as libftdi: set error string and return */
+#define ftdi_error_return(code, str) do {  \
+        if ( ftdi )                        \
+            ftdi->error_str = str;         \
+        else                               \
+            fprintf(stderr, str);          \
+        return code;                       \
+   } while(0);
+
+/* transfer counters, optional (NULL) argument of EEPROM access functions */
+struct my_ftdi_stats {
+    unsigned long transfers;    /* control transfers issued */
+    unsigned long retries;      /* transfers issued again after a failure */
+    unsigned long failures;     /* transfers which failed */
+};
+#define my_ftdi_stats_add(stats, field, n) do { \
+        if (stats)                              \
+            (stats)->field += (n);              \
+   } while (0)
+
 int my_ftdi_eeprom_build(struct ftdi_context *ftdi);
+void my_ftdi_eeprom_guess_size(struct ftdi_context *ftdi);
+int my_ftdi_eeprom_raw_ids(struct ftdi_context *ftdi);
+/* EEPROM size probe: once the lower 128 bytes are read, compare a few
+ * words with their alias 128 bytes above
+ */
+#define MY_FTDI_PROBE_WORDS 4
+int my_ftdi_eeprom_probe_addr(struct ftdi_context *ftdi, int i);
+int my_ftdi_eeprom_probe_size(struct ftdi_context *ftdi,
+		const unsigned short *probe);
+int my_ftdi_eeprom_diff(struct ftdi_context *ftdi, const unsigned char *orig,
+		unsigned char *changed);
+int my_ftdi_write_prepare(struct ftdi_context *ftdi,
+		struct my_ftdi_stats *stats);
+int my_ftdi_write_eeprom_diff(struct ftdi_context *ftdi,
+		const unsigned char *orig, struct my_ftdi_stats *stats);
+
+/* async EEPROM access (myftdi_async.c) */
+#define MY_FTDI_ASYNC_WINDOW 32
+int my_ftdi_read_eeprom_async(struct ftdi_context *ftdi, int window,
+		struct my_ftdi_stats *stats);
+int my_ftdi_write_eeprom_async(struct ftdi_context *ftdi,
+		const unsigned char *orig, int window, int delay_us, int retries,
+		struct my_ftdi_stats *stats);
 #endif
@@ -0,0 +1,715 @@
+#include <libusb.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "ftdi_i.h"
+#include <ftdi.h>
+#include "myftdi.h"
+
+/* Pipelined EEPROM access: up to window SIO_*_EEPROM control transfers
+ * are queued on the control endpoint so USB round-trip latency is paid
+ * once per window instead of once per word.
+ */
+
+struct async_read {
+    struct ftdi_context *ftdi;
+    struct my_ftdi_stats *stats;
+    unsigned char *buf;
+    int nb_words;       /* first word address not to read */
+    int next;           /* next word address to submit */
+    int inflight;
+    int completed;      /* set when inflight reaches 0 */
+    int error;
+    int nb_done;
+};
+
+struct async_slot {
+    struct async_read *rd;
+    int addr;
+    int queued;         /* transfer submitted, callback not run yet */
+};
+
+static long long async_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/* every transfer ends within its timeout: no callback at all for twice
+ * the longest one, the backend is not going to call back
+ */
+static long long async_stall_us(struct ftdi_context *ftdi)
+{
+    int timeout = ftdi->usb_read_timeout;
+
+    if (ftdi->usb_write_timeout > timeout)
+        timeout = ftdi->usb_write_timeout;
+    return 2000LL * timeout;
+}
+
+/* consecutive event handling errors after which a drain gives up */
+#define ASYNC_DRAIN_ERRORS 3
+
+/* wait for the callbacks of every transfer still in flight, cancelled
+ * ones included: they can only be freed afterwards. Each transfer ends
+ * within its timeout, the wait is bounded anyway: a backend which never
+ * calls back must not hang the caller.
+ * return -1 when transfers are left in flight: they, and all their
+ * callbacks use, must then be leaked, not freed
+ */
+static int async_drain(struct ftdi_context *ftdi, const int *inflight)
+{
+    struct timeval tv;
+    long long deadline = async_now_us() + async_stall_us(ftdi);
+    int errors = 0;
+
+    while (*inflight > 0 && async_now_us() < deadline)
+    {
+        tv.tv_sec = 0;
+        tv.tv_usec = 100000;
+        if (libusb_handle_events_timeout_completed(ftdi->usb_ctx, &tv,
+                                                   NULL) == 0)
+            errors = 0;
+        else if (++errors == ASYNC_DRAIN_ERRORS)
+            break;
+    }
+    return (*inflight > 0) ? -1 : 0;
+}
+
+static int async_read_submit(struct libusb_transfer *transfer)
+{
+    struct async_slot *slot = transfer->user_data;
+    struct async_read *rd = slot->rd;
+
+    slot->addr = rd->next++;
+    libusb_fill_control_setup(transfer->buffer, FTDI_DEVICE_IN_REQTYPE,
+                              SIO_READ_EEPROM_REQUEST, 0, slot->addr, 2);
+    if (libusb_submit_transfer(transfer) < 0)
+        return -1;
+    my_ftdi_stats_add(rd->stats, transfers, 1);
+    slot->queued = 1;
+    rd->inflight++;
+    return 0;
+}
+
+static void LIBUSB_CALL async_read_cb(struct libusb_transfer *transfer)
+{
+    struct async_slot *slot = transfer->user_data;
+    struct async_read *rd = slot->rd;
+
+    rd->inflight--;
+    slot->queued = 0;
+
+    if (transfer->status != LIBUSB_TRANSFER_COMPLETED ||
+        transfer->actual_length != 2)
+    {
+        my_ftdi_stats_add(rd->stats, failures, 1);
+        rd->error = 1;
+    }
+    else
+    {
+        memcpy(rd->buf + slot->addr*2,
+               libusb_control_transfer_get_data(transfer), 2);
+        rd->nb_done++;
+        /* keep the slot busy while words remain */
+        if (!rd->error && rd->next < rd->nb_words &&
+            async_read_submit(transfer) == 0)
+            return;
+    }
+
+    if (rd->inflight == 0)
+        rd->completed = 1;
+}
+
+/* blocking read of words [first, last[, retry when it follows a failed
+ * pipelined one
+ */
+static int read_words_blocking(struct ftdi_context *ftdi,
+                               struct my_ftdi_stats *stats, int first,
+                               int last, int retry)
+{
+    unsigned short val;
+    int i;
+
+    for (i = first; i < last; i++)
+    {
+        my_ftdi_stats_add(stats, transfers, 1);
+        if (retry)
+            my_ftdi_stats_add(stats, retries, 1);
+        if (ftdi_read_eeprom_location(ftdi, i, &val) != 0)
+        {
+            my_ftdi_stats_add(stats, failures, 1);
+            ftdi_error_return(-1, "reading eeprom failed");
+        }
+        ftdi->eeprom->buf[i*2] = val & 0xff;
+        ftdi->eeprom->buf[i*2 + 1] = val >> 8;
+    }
+    return 0;
+}
+
+/* read words [first, last[ with up to window pending transfers
+ * return 0 when all words were read
+ */
+static int read_words_async(struct ftdi_context *ftdi, int window,
+                            struct my_ftdi_stats *stats, int first, int last)
+{
+    struct async_read *rd;
+    struct libusb_transfer **transfers;
+    struct async_slot *slots;
+    struct timeval tv;
+    long long stall;
+    int i, ret, partial, nb_done;
+
+    /* on the heap: leaked with its transfers when they can't be drained */
+    if ((rd = calloc(1, sizeof(struct async_read))) == NULL)
+        return read_words_blocking(ftdi, stats, first, last, 0);
+    rd->ftdi = ftdi;
+    rd->stats = stats;
+    rd->buf = ftdi->eeprom->buf;
+    rd->next = first;
+    rd->nb_words = last;
+    if (window > last - first)
+        window = last - first;
+
+    transfers = calloc(window, sizeof(struct libusb_transfer *));
+    slots = calloc(window, sizeof(struct async_slot));
+    if (transfers == NULL || slots == NULL)
+    {
+        free(transfers);
+        free(slots);
+        free(rd);
+        return read_words_blocking(ftdi, stats, first, last, 0);
+    }
+
+    for (i = 0; i < window; i++)
+    {
+        unsigned char *b = malloc(LIBUSB_CONTROL_SETUP_SIZE + 2);
+        transfers[i] = libusb_alloc_transfer(0);
+        if (b == NULL || transfers[i] == NULL)
+        {
+            free(b);
+            rd->error = 1;
+            break;
+        }
+        slots[i].rd = rd;
+        libusb_fill_control_transfer(transfers[i], ftdi->usb_dev, b,
+                                     async_read_cb, &slots[i],
+                                     ftdi->usb_read_timeout);
+        transfers[i]->flags = LIBUSB_TRANSFER_FREE_BUFFER;
+        if (async_read_submit(transfers[i]) != 0)
+        {
+            rd->error = 1;
+            break;
+        }
+    }
+    if (rd->inflight == 0)
+        rd->completed = 1;
+
+    /* wait all pending transfers, even on error, before freeing them */
+    nb_done = rd->nb_done;
+    stall = async_now_us() + async_stall_us(ftdi);
+    while (!rd->completed)
+    {
+        tv.tv_sec = 1;
+        tv.tv_usec = 0;
+        ret = libusb_handle_events_timeout_completed(ftdi->usb_ctx, &tv,
+                                                     &rd->completed);
+        if (rd->nb_done != nb_done)
+        {
+            nb_done = rd->nb_done;
+            stall = async_now_us() + async_stall_us(ftdi);
+        }
+        if (ret < 0 || (!rd->completed && async_now_us() > stall))
+        {
+            /* no resubmit from callbacks, cancel what is queued */
+            rd->error = 1;
+            for (i = 0; i < window; i++)
+                if (slots[i].queued)
+                    libusb_cancel_transfer(transfers[i]);
+            if (async_drain(ftdi, &rd->inflight) != 0)
+            {
+                /* late callbacks use slots, rd and the transfers */
+                free(transfers);
+                ftdi_error_return(-1, "EEPROM reads stuck in flight");
+            }
+            break;
+        }
+    }
+
+    for (i = 0; i < window; i++)
+        if (transfers[i])
+            libusb_free_transfer(transfers[i]);
+    free(transfers);
+    free(slots);
+
+    if (rd->error || rd->nb_done != last - first)
+    {
+        partial = rd->nb_done + rd->error > 0;
+        free(rd);
+        return read_words_blocking(ftdi, stats, first, last, partial);
+    }
+    free(rd);
+    return 0;
+}
+
+static int read_words(struct ftdi_context *ftdi, int window,
+                      struct my_ftdi_stats *stats, int first, int last)
+{
+    if (window <= 1)
+        return read_words_blocking(ftdi, stats, first, last, 0);
+    return read_words_async(ftdi, window, stats, first, last);
+}
+
+/**
+    Read EEPROM content with up to window pending control transfers.
+    Fall back to blocking reads when the device or the host controller
+    refuses queued requests.
+
+    The lower 128 bytes are read first, then EEPROM size is probed with
+    a few aliased words: the upper half is only read from a 256 bytes
+    EEPROM.
+
+    \param ftdi pointer to ftdi_context
+    \param window max number of pending transfers, <= 1: blocking
+    \param stats transfer counters, may be NULL
+
+    \retval  0: all fine
+    \retval -1: read failed
+    \retval -2: USB device unavailable
+*/
+int my_ftdi_read_eeprom_async(struct ftdi_context *ftdi, int window,
+                              struct my_ftdi_stats *stats)
+{
+    unsigned short probe[MY_FTDI_PROBE_WORDS];
+    int i, addr = -1, half = 0x80/2;
+
+    if (ftdi == NULL || ftdi->usb_dev == NULL)
+        ftdi_error_return(-2, "USB device unavailable");
+
+    if (read_words(ftdi, window, stats, 0, half) != 0)
+        return -1;
+
+    for (i = 0; i < MY_FTDI_PROBE_WORDS; i++)
+    {
+        if ((addr = my_ftdi_eeprom_probe_addr(ftdi, i)) < 0)
+            break;
+        my_ftdi_stats_add(stats, transfers, 1);
+        if (ftdi_read_eeprom_location(ftdi, addr, &probe[i]) != 0)
+        {
+            my_ftdi_stats_add(stats, failures, 1);
+            break;
+        }
+    }
+    if (my_ftdi_eeprom_probe_size(ftdi,
+            (addr < 0 || i == MY_FTDI_PROBE_WORDS) ? probe : NULL) > 0)
+        return 0;
+
+    if (read_words(ftdi, window, stats, half, FTDI_MAX_EEPROM_SIZE/2) != 0)
+        return -1;
+    my_ftdi_eeprom_guess_size(ftdi);
+    return 0;
+}
+
+enum {
+    WORD_IDLE = 0,      /* not to write */
+    WORD_PENDING,       /* to write */
+    WORD_INFLIGHT,      /* write and read back queued */
+    WORD_OK,            /* read back matches */
+    WORD_FAILED         /* write or read back failed, to retry */
+};
+
+struct async_write {
+    struct ftdi_context *ftdi;
+    struct my_ftdi_stats *stats;
+    int pass;
+    const unsigned char *image;
+    unsigned char state[FTDI_MAX_EEPROM_SIZE/2];
+    int addrs[FTDI_MAX_EEPROM_SIZE/2];  /* words for this pass, ascending */
+    int nb_addrs;
+    int next;           /* index in addrs of next word to submit */
+    int ordered;        /* addrs[0 .. ordered-1] are all completed */
+    int csum_addr;      /* checksum word, written after all others */
+    int inflight;       /* queued transfers (writes and read backs) */
+    int event;          /* set by callbacks to wake up submit loop */
+};
+
+struct async_wslot {
+    struct async_write *wr;
+    struct libusb_transfer *wr_xfer;
+    struct libusb_transfer *rd_xfer;
+    int addr;
+    int busy;
+    int write_ok;
+    int read_queued;
+    int wr_inflight;    /* write submitted, callback not run yet */
+    int rd_inflight;    /* read back submitted, callback not run yet */
+};
+
+/* in order completion tracking, see async_write_next() */
+static void async_ordered_update(struct async_write *wr)
+{
+    while (wr->ordered < wr->nb_addrs &&
+           wr->state[wr->addrs[wr->ordered]] >= WORD_OK)
+        wr->ordered++;
+}
+
+static void async_word_done(struct async_wslot *slot, int ok)
+{
+    struct async_write *wr = slot->wr;
+
+    wr->state[slot->addr] = ok ? WORD_OK : WORD_FAILED;
+    slot->busy = 0;
+    async_ordered_update(wr);
+    wr->event = 1;
+}
+
+static void LIBUSB_CALL async_write_cb(struct libusb_transfer *transfer)
+{
+    struct async_wslot *slot = transfer->user_data;
+
+    slot->wr->inflight--;
+    slot->wr_inflight = 0;
+    slot->write_ok = (transfer->status == LIBUSB_TRANSFER_COMPLETED);
+    if (!slot->write_ok)
+        my_ftdi_stats_add(slot->wr->stats, failures, 1);
+    /* read back never queued: nothing else will complete this word */
+    if (!slot->read_queued)
+        async_word_done(slot, 0);
+}
+
+static void LIBUSB_CALL async_readback_cb(struct libusb_transfer *transfer)
+{
+    struct async_wslot *slot = transfer->user_data;
+    const unsigned char *image = slot->wr->image;
+    unsigned char *data = libusb_control_transfer_get_data(transfer);
+    int ok;
+
+    slot->wr->inflight--;
+    slot->rd_inflight = 0;
+    if (transfer->status != LIBUSB_TRANSFER_COMPLETED)
+        my_ftdi_stats_add(slot->wr->stats, failures, 1);
+    ok = slot->write_ok && transfer->status == LIBUSB_TRANSFER_COMPLETED &&
+         transfer->actual_length == 2 &&
+         data[0] == image[slot->addr*2] && data[1] == image[slot->addr*2+1];
+    async_word_done(slot, ok);
+}
+
+/* queue write of one word immediately followed by its read back:
+ * control requests are handled in order by the device so the read
+ * returns the programmed value
+ */
+static int async_write_submit(struct async_wslot *slot, int addr)
+{
+    struct async_write *wr = slot->wr;
+    unsigned short val = wr->image[addr*2] | (wr->image[addr*2+1] << 8);
+
+    slot->addr = addr;
+    slot->write_ok = 0;
+    slot->read_queued = 0;
+    libusb_fill_control_setup(slot->wr_xfer->buffer, FTDI_DEVICE_OUT_REQTYPE,
+                              SIO_WRITE_EEPROM_REQUEST, val, addr, 0);
+    libusb_fill_control_setup(slot->rd_xfer->buffer, FTDI_DEVICE_IN_REQTYPE,
+                              SIO_READ_EEPROM_REQUEST, 0, addr, 2);
+    if (libusb_submit_transfer(slot->wr_xfer) < 0)
+        return -1;
+    slot->busy = 1;
+    slot->wr_inflight = 1;
+    wr->inflight++;
+    wr->state[addr] = WORD_INFLIGHT;
+    if (libusb_submit_transfer(slot->rd_xfer) == 0)
+    {
+        slot->read_queued = 1;
+        slot->rd_inflight = 1;
+        wr->inflight++;
+    }
+    my_ftdi_stats_add(wr->stats, transfers, 1 + slot->read_queued);
+    if (wr->pass > 0)
+        my_ftdi_stats_add(wr->stats, retries, 1 + slot->read_queued);
+    return 0;
+}
+
+static void async_wslots_free(struct async_wslot *slots, int window)
+{
+    int i;
+
+    for (i = 0; i < window; i++)
+    {
+        if (slots[i].wr_xfer)
+            libusb_free_transfer(slots[i].wr_xfer);
+        if (slots[i].rd_xfer)
+            libusb_free_transfer(slots[i].rd_xfer);
+    }
+    free(slots);
+}
+
+static struct async_wslot *async_wslots_alloc(struct async_write *wr,
+                                              int window)
+{
+    struct async_wslot *slots;
+    struct async_wslot *slot;
+    unsigned char *b;
+    int i;
+
+    slots = calloc(window, sizeof(struct async_wslot));
+    if (slots == NULL)
+        return NULL;
+
+    for (i = 0; i < window; i++)
+    {
+        slot = &slots[i];
+        slot->wr = wr;
+        slot->wr_xfer = libusb_alloc_transfer(0);
+        slot->rd_xfer = libusb_alloc_transfer(0);
+        if (slot->wr_xfer == NULL || slot->rd_xfer == NULL)
+            goto err;
+
+        if ((b = malloc(LIBUSB_CONTROL_SETUP_SIZE)) == NULL)
+            goto err;
+        libusb_fill_control_transfer(slot->wr_xfer, wr->ftdi->usb_dev, b,
+                                     async_write_cb, slot,
+                                     wr->ftdi->usb_write_timeout);
+        slot->wr_xfer->flags = LIBUSB_TRANSFER_FREE_BUFFER;
+
+        if ((b = malloc(LIBUSB_CONTROL_SETUP_SIZE + 2)) == NULL)
+            goto err;
+        libusb_fill_control_transfer(slot->rd_xfer, wr->ftdi->usb_dev, b,
+                                     async_readback_cb, slot,
+                                     wr->ftdi->usb_read_timeout);
+        slot->rd_xfer->flags = LIBUSB_TRANSFER_FREE_BUFFER;
+    }
+    return slots;
+err:
+    async_wslots_free(slots, window);
+    return NULL;
+}
+
+/* after an event handling error: cancel queued transfers, wait for
+ * their callbacks and mark every word not confirmed as failed
+ * return -1 when transfers are stuck in flight (see async_drain())
+ */
+static int async_write_abort(struct async_write *wr,
+                             struct async_wslot *slots, int window)
+{
+    int i;
+
+    for (i = 0; i < window; i++)
+    {
+        if (slots[i].wr_inflight)
+            libusb_cancel_transfer(slots[i].wr_xfer);
+        if (slots[i].rd_inflight)
+            libusb_cancel_transfer(slots[i].rd_xfer);
+    }
+    if (async_drain(wr->ftdi, &wr->inflight) != 0)
+        return -1;
+    for (i = 0; i < FTDI_MAX_EEPROM_SIZE/2; i++)
+        if (wr->state[i] == WORD_PENDING || wr->state[i] == WORD_INFLIGHT)
+            wr->state[i] = WORD_FAILED;
+    return 0;
+}
+
+/* index in addrs of the word to submit now, -1 to wait for completions.
+ * The checksum word goes last, once every other word of the pass is
+ * confirmed: a device never holds the new checksum with old content.
+ * When one of them failed, it is left for the next pass
+ */
+static int async_write_next(struct async_write *wr)
+{
+    int i;
+
+    if (wr->addrs[wr->next] != wr->csum_addr)
+        return wr->next;
+    if (wr->ordered < wr->next)
+        return -1;
+    for (i = 0; i < wr->next; i++)
+    {
+        if (wr->state[wr->addrs[i]] == WORD_FAILED)
+        {
+            wr->state[wr->csum_addr] = WORD_FAILED;
+            wr->next++;
+            async_ordered_update(wr);
+            return -1;
+        }
+    }
+    return wr->next;
+}
+
+/* one pass over all WORD_PENDING words
+ * return number of submitted words, -1 if no transfer could be queued,
+ * -2 when event handling failed or stalled (transfers cancelled, words not
+ * confirmed marked failed), -3 when cancelled transfers never ended
+ */
+static int async_write_pass(struct async_write *wr, struct async_wslot *slots,
+                            int window, int delay_us)
+{
+    struct timeval tv;
+    long long now, next_due = 0, wait_us, stall = 0;
+    int i, ret, submitted = 0;
+
+    wr->nb_addrs = 0;
+    for (i = 0; i < FTDI_MAX_EEPROM_SIZE/2; i++)
+        if (wr->state[i] == WORD_PENDING)
+            wr->addrs[wr->nb_addrs++] = i;
+    wr->next = 0;
+    wr->ordered = 0;
+
+    while (wr->next < wr->nb_addrs || wr->inflight > 0)
+    {
+        now = async_now_us();
+        for (i = 0; i < window && wr->next < wr->nb_addrs; i++)
+        {
+            /* respect EEPROM programming time between two words */
+            if (now < next_due)
+                break;
+            if (slots[i].busy)
+                continue;
+            if (async_write_next(wr) < 0)
+                break;
+            if (async_write_submit(&slots[i], wr->addrs[wr->next]) != 0)
+            {
+                if (submitted == 0 && wr->inflight == 0)
+                    return -1;
+                wr->state[wr->addrs[wr->next]] = WORD_FAILED;
+            }
+            else
+            {
+                submitted++;
+            }
+            wr->next++;
+            async_ordered_update(wr);
+            next_due = now + delay_us;
+        }
+        /* checksum skipped on the last word: nothing left */
+        if (wr->next == wr->nb_addrs && wr->inflight == 0)
+            break;
+
+        wait_us = 100000;
+        if (wr->next < wr->nb_addrs && next_due > now &&
+            next_due - now < wait_us)
+            wait_us = next_due - now;
+        if (wr->inflight == 0 && wait_us > 0)
+        {
+            /* nothing to wait from USB side, only the inter-word delay */
+            struct timespec ts = {wait_us / 1000000, (wait_us % 1000000) * 1000};
+            nanosleep(&ts, NULL);
+            stall = 0;
+            continue;
+        }
+        tv.tv_sec = wait_us / 1000000;
+        tv.tv_usec = wait_us % 1000000;
+        wr->event = 0;
+        ret = libusb_handle_events_timeout_completed(wr->ftdi->usb_ctx, &tv,
+                                                     &wr->event);
+        now = async_now_us();
+        if (wr->event || stall == 0)
+            stall = now + async_stall_us(wr->ftdi);
+        if (ret < 0 || (wr->inflight > 0 && now > stall))
+            return (async_write_abort(wr, slots, window) != 0) ? -3 : -2;
+    }
+    return submitted;
+}
+
+/**
+    Write words of eeprom->buf which differ from orig with up to window
+    words (write + read back) queued on the control endpoint. Words whose
+    write or read back fails are marked and only those are retried.
+
+    \param ftdi pointer to ftdi_context
+    \param orig EEPROM content as read before build
+    \param window max number of words in flight
+    \param delay_us min delay between two word writes (EEPROM programming time)
+    \param retries extra passes for failed words
+    \param stats transfer counters, may be NULL
+
+    \retval >=0: number of words written
+    \retval -1: write failed
+    \retval -2: USB device unavailable
+    \retval -3: EEPROM not initialized for the connected device
+    \retval -5: read back mismatch after all retries
+*/
+int my_ftdi_write_eeprom_async(struct ftdi_context *ftdi,
+                               const unsigned char *orig, int window,
+                               int delay_us, int retries,
+                               struct my_ftdi_stats *stats)
+{
+    struct async_write *wr;
+    struct async_wslot *slots;
+    unsigned char changed[FTDI_MAX_EEPROM_SIZE/2];
+    int i, ret, pass, nb_changed, nb_failed = 0;
+
+    if (ftdi == NULL || ftdi->usb_dev == NULL)
+        ftdi_error_return(-2, "USB device unavailable");
+
+    if (window <= 1)
+        return my_ftdi_write_eeprom_diff(ftdi, orig, stats);
+
+    nb_changed = my_ftdi_eeprom_diff(ftdi, orig, changed);
+    if (nb_changed == 0)
+        return 0;
+
+    if ((ret = my_ftdi_write_prepare(ftdi, stats)) != 0)
+        return ret;
+
+    if ((wr = calloc(1, sizeof(struct async_write))) == NULL)
+        return my_ftdi_write_eeprom_diff(ftdi, orig, stats);
+    wr->ftdi = ftdi;
+    wr->stats = stats;
+    wr->image = ftdi->eeprom->buf;
+    wr->csum_addr = ftdi->eeprom->size/2 - 1;
+    for (i = 0; i < FTDI_MAX_EEPROM_SIZE/2; i++)
+        wr->state[i] = changed[i] ? WORD_PENDING : WORD_IDLE;
+
+    if (window > nb_changed)
+        window = nb_changed;
+    if ((slots = async_wslots_alloc(wr, window)) == NULL)
+    {
+        free(wr);
+        return my_ftdi_write_eeprom_diff(ftdi, orig, stats);
+    }
+
+    for (pass = 0; pass <= retries; pass++)
+    {
+        wr->pass = pass;
+        ret = async_write_pass(wr, slots, window, delay_us);
+        if (ret == -2 || ret == -3)
+            break;
+        if (ret < 0)
+        {
+            /* queued requests refused: fall back to blocking path */
+            if (pass == 0)
+            {
+                async_wslots_free(slots, window);
+                free(wr);
+                return my_ftdi_write_eeprom_diff(ftdi, orig, stats);
+            }
+            break;
+        }
+        nb_failed = 0;
+        for (i = 0; i < FTDI_MAX_EEPROM_SIZE/2; i++)
+        {
+            if (wr->state[i] == WORD_FAILED)
+            {
+                wr->state[i] = WORD_PENDING;
+                nb_failed++;
+            }
+        }
+        if (nb_failed == 0)
+            break;
+    }
+
+    /* late callbacks use slots and wr: leaked with the transfers */
+    if (ret == -3)
+        ftdi_error_return(-1, "EEPROM writes stuck in flight");
+    async_wslots_free(slots, window);
+    free(wr);
+
+    /* words left unconfirmed: verify reads them back */
+    if (ret == -2)
+        ftdi_error_return(-1, "eeprom write events failed");
+    if (nb_failed)
+        ftdi_error_return(-5, "eeprom read back mismatch");
+    return nb_changed;
+}
@@ -0,0 +1,166 @@
+#include <string.h>
+
+#include "ftdi_i.h"
+#include <ftdi.h>
+#include "myftdi_layout.h"
+#include "myftdi_image.h"
+
+static unsigned short rotl16(unsigned short v, int n)
+{
+    n &= 15;
+    return (n) ? (unsigned short)((v << n) | (v >> (16 - n))) : v;
+}
+
+/**
+    Load an EEPROM image and compute its checksum, same algorithm as
+    my_ftdi_eeprom_build(): checksum starts at 0xAAAA, each word is xor-ed
+    then checksum is rotated left by one. Words excluded by the layout are
+    skipped, factory words come from the device.
+
+    \param img image to initialize
+    \param layout chip layout, may be NULL (all words accounted)
+    \param buf image content
+    \param size image size in bytes, last word receives checksum
+    \param factory layout factory words read from device, NULL: from buf
+*/
+void my_eeprom_image_init(struct my_eeprom_image *img,
+        const struct my_eeprom_layout *layout, const unsigned char *buf,
+        int size, const unsigned short *factory)
+{
+    int i, n, nb_words = size / 2 - 1;
+    unsigned short checksum = 0xAAAA, value;
+
+    memset(img, 0, sizeof(*img));
+    img->layout = layout;
+    img->size = size;
+    memcpy(img->buf, buf, size);
+    memset(img->rot, -1, sizeof(img->rot));
+
+    /* n: words accounted so far */
+    for (i = 0, n = 0; i < nb_words; i++)
+    {
+        if (layout && i == layout->csum_skip_start &&
+            i < layout->csum_skip_end)
+        {
+            /* user section in the MTP which is not part of the checksum */
+            i = layout->csum_skip_end;
+        }
+        if (layout && factory && i >= layout->factory_start &&
+            i < layout->factory_end)
+        {
+            img->factory[i] = 1;
+            value = factory[i - layout->factory_start];
+        }
+        else
+        {
+            value = img->buf[i*2] | (img->buf[(i*2)+1] << 8);
+        }
+        img->word[i] = value;
+        img->rot[i] = n++;
+        checksum = value^checksum;
+        checksum = (checksum << 1) | (checksum >> 15);
+    }
+
+    /* rot[] holds word position for now: contribution of a word is
+     * rotated once per word accounted from it to the end
+     */
+    for (i = 0; i < MY_IMAGE_WORDS; i++)
+        if (img->rot[i] >= 0)
+            img->rot[i] = (n - img->rot[i]) & 15;
+
+    img->checksum = checksum;
+    img->buf[size - 2] = checksum;
+    img->buf[size - 1] = checksum >> 8;
+}
+
+void my_eeprom_image_set(struct my_eeprom_image *img, int addr,
+        const unsigned char *data, int len)
+{
+    int i, w, last = img->size / 2 - 1;
+    unsigned short value;
+
+    if (addr < 0 || addr + len > img->size)
+        return;
+    memcpy(img->buf + addr, data, len);
+
+    for (w = addr / 2; w <= (addr + len - 1) / 2; w++)
+    {
+        if (w >= last || img->rot[w] < 0 || img->factory[w])
+            continue;
+        i = w * 2;
+        value = img->buf[i] | (img->buf[i + 1] << 8);
+        if (value == img->word[w] || my_eeprom_image_is_dirty(img, w))
+            continue;
+        img->dirty[w / 32] |= 1u << (w % 32);
+        img->nb_dirty++;
+    }
+}
+
+int my_eeprom_image_is_dirty(const struct my_eeprom_image *img, int word)
+{
+    return (img->dirty[word / 32] >> (word % 32)) & 1;
+}
+
+unsigned short my_eeprom_image_update(struct my_eeprom_image *img)
+{
+    int w, i;
+    unsigned short value;
+
+    for (w = 0; img->nb_dirty && w < MY_IMAGE_WORDS; w++)
+    {
+        if (!my_eeprom_image_is_dirty(img, w))
+            continue;
+        i = w * 2;
+        value = img->buf[i] | (img->buf[i + 1] << 8);
+        img->checksum ^= rotl16(value ^ img->word[w], img->rot[w]);
+        img->word[w] = value;
+        img->dirty[w / 32] &= ~(1u << (w % 32));
+        img->nb_dirty--;
+    }
+
+    img->buf[img->size - 2] = img->checksum;
+    img->buf[img->size - 1] = img->checksum >> 8;
+    return img->checksum;
+}
+
+/* patch every entry of a field table storing src */
+static int image_patch_table(struct my_eeprom_image *img,
+        const struct my_eeprom_field *f, int nb, int src,
+        const struct ftdi_eeprom *values)
+{
+    unsigned char tmp[256], byte, mask;
+    int i, found = 0;
+
+    for (i = 0; i < nb; i++, f++)
+    {
+        if (f->src != src || f->addr >= img->size - 2)
+            continue;
+        /* bits this entry would write in an empty byte */
+        tmp[f->addr] = 0;
+        my_ftdi_eeprom_encode(f, 1, values, tmp);
+        mask = my_eeprom_field_mask(f);
+        byte = (img->buf[f->addr] & ~mask) | (tmp[f->addr] & mask);
+        my_eeprom_image_set(img, f->addr, &byte, 1);
+        found++;
+    }
+    return found;
+}
+
+int my_eeprom_image_patch(struct my_eeprom_image *img,
+        enum ftdi_eeprom_value field, int value)
+{
+    static const struct ftdi_eeprom zero;
+    struct ftdi_eeprom values = zero;
+    const struct my_eeprom_layout *layout = img->layout;
+    int src = my_ftdi_eeprom_value_src(field), found;
+
+    if (layout == NULL || src < 0)
+        return -1;
+    *(int *)((char *)&values + src) = value;
+
+    found = image_patch_table(img, layout->head, layout->nb_head, src,
+                              &values);
+    found += image_patch_table(img, layout->fields, layout->nb_fields, src,
+                               &values);
+    return (found) ? found : -1;
+}
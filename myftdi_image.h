@@ -0,0 +1,66 @@
+#ifndef MY_FTDI_IMAGE_H_
+#define MY_FTDI_IMAGE_H_
+#include <ftdi.h>
+#include "myftdi_layout.h"
+
+#define MY_IMAGE_WORDS  (256 / 2)
+
+/* EEPROM image with its checksum kept up to date word by word.
+ * Checksum is a rotate-and-xor of words: it is linear, so a word changed
+ * by delta changes checksum by delta rotated by the number of words
+ * accounted after it. Changed words are marked dirty and only them are
+ * replayed by my_eeprom_image_update().
+ */
+struct my_eeprom_image {
+    const struct my_eeprom_layout *layout;
+    int size;                               /* bytes, 64, 128 or 256 */
+    unsigned char buf[256];
+    unsigned short checksum;                /* of word[] */
+    unsigned short word[MY_IMAGE_WORDS];    /* value accounted in checksum */
+    signed char rot[MY_IMAGE_WORDS];        /* left rotation in checksum,
+                                               -1: word not accounted */
+    unsigned char factory[MY_IMAGE_WORDS];  /* value read from device, not
+                                               from buf */
+    unsigned int dirty[MY_IMAGE_WORDS / 32];
+    int nb_dirty;
+};
+
+/* load buf (size bytes) and compute checksum from scratch. factory holds
+ * layout factory words read from device, NULL: taken from buf
+ */
+void my_eeprom_image_init(struct my_eeprom_image *img,
+        const struct my_eeprom_layout *layout, const unsigned char *buf,
+        int size, const unsigned short *factory);
+/* change len bytes at addr, words which really change are marked dirty */
+void my_eeprom_image_set(struct my_eeprom_image *img, int addr,
+        const unsigned char *data, int len);
+int my_eeprom_image_is_dirty(const struct my_eeprom_image *img, int word);
+/* account dirty words, store checksum in the last word and return it */
+unsigned short my_eeprom_image_update(struct my_eeprom_image *img);
+/* set field (as ftdi_set_eeprom_value()) by changing only its bits in
+ * image, other bytes and bits stay as read. return number of bytes
+ * touched or -1 when field is not stored in config bytes of this layout
+ */
+int my_eeprom_image_patch(struct my_eeprom_image *img,
+        enum ftdi_eeprom_value field, int value);
+
+/* my_eeprom_build_image() diagnostics */
+#define MY_BUILD_WARN_USER_DATA_CONFIG  0x01    /* user data starts inside
+                                                   generated data */
+#define MY_BUILD_WARN_USER_DATA_STRINGS 0x02    /* user data overlaps strings */
+#define MY_BUILD_WARN_FACTORY           0x04    /* no factory data given */
+
+struct my_eeprom_build_diag {
+    int size;               /* image size in bytes */
+    int user_area_size;     /* bytes left for strings */
+    unsigned int warnings;  /* MY_BUILD_WARN_* */
+    const char *error;      /* set on failure */
+};
+
+/* pure builder, no device access nor output (myftdi.c) */
+int my_eeprom_build_image(const struct my_eeprom_layout *layout,
+        const struct ftdi_eeprom *eeprom, const unsigned short *factory,
+        unsigned char *image, struct my_eeprom_build_diag *diag);
+int my_ftdi_read_factory(struct ftdi_context *ftdi,
+        const struct my_eeprom_layout *layout, unsigned short *factory);
+#endif
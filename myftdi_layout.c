@@ -0,0 +1,410 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "ftdi_i.h"
+#include <ftdi.h>
+#include "myftdi_layout.h"
+
+/* EEPROM layouts of libftdi 1.4 supported chips, field by field in the
+ * same order as ftdi_eeprom_build() writes them
+ */
+
+#define E(f)    ((short)offsetof(struct ftdi_eeprom, f))
+
+#define SET(a, f)           {a, MY_OP_SET, MY_ENC_LO, 0, 0, E(f), 0, 0}
+#define SET_HI(a, f)        {a, MY_OP_SET, MY_ENC_HI, 0, 0, E(f), 0, 0}
+#define SET_U16(a, f)       SET(a, f), SET_HI((a) + 1, f)
+#define SET_CONST(a, c)     {a, MY_OP_SET, MY_ENC_CONST, 0, 0, -1, c, 0}
+#define SET_DIV(a, f, d)    {a, MY_OP_SET, MY_ENC_DIV, 0, 0, E(f), d, 0}
+#define SET_TYPE(a, f, set) {a, MY_OP_SET, MY_ENC_ONEOF, 0, 0, E(f), set, 0}
+#define SET_LIMIT(a, f, max, def, sh) \
+        {a, MY_OP_SET, MY_ENC_LIMIT, sh, 0, E(f), max, def}
+#define OR_LIMIT(a, f, max, def, sh) \
+        {a, MY_OP_OR, MY_ENC_LIMIT, sh, 0, E(f), max, def}
+#define BIT(a, f, b)        {a, MY_OP_BIT, MY_ENC_NZ, 0, b, E(f), 0, 0}
+#define BIT_EQ(a, f, v, b)  {a, MY_OP_BIT, MY_ENC_EQ, 0, b, E(f), v, 0}
+#define ORIF(a, f, b)       {a, MY_OP_ORIF, MY_ENC_NZ, 0, b, E(f), 0, 0}
+#define ORIF_EQ(a, f, v, b) {a, MY_OP_ORIF, MY_ENC_EQ, 0, b, E(f), v, 0}
+
+/* drive (clamped to 16mA), schmitt and slew of a 4 bits pin group */
+#define GROUP(a, n, sh) \
+        OR_LIMIT(a, group##n##_drive, DRIVE_16MA, DRIVE_16MA, sh), \
+        ORIF_EQ(a, group##n##_schmitt, IS_SCHMITT, IS_SCHMITT << (sh)), \
+        ORIF_EQ(a, group##n##_slew, SLOW_SLEW, SLOW_SLEW << (sh))
+
+/* two CBUS functions of FT232H in one byte, out of range: tristate */
+#define CBUSH(a, n) \
+        SET_LIMIT(a, cbus_function[2 * (n)], CBUSH_CLK7_5, CBUSH_TRISTATE, 0), \
+        OR_LIMIT(a, cbus_function[2 * (n) + 1], CBUSH_CLK7_5, CBUSH_TRISTATE, 4)
+
+/* channel types each chip accepts, others are stored as UART */
+#define TYPES_R     (1 << CHANNEL_IS_UART | 1 << CHANNEL_IS_FIFO)
+#define TYPES_2232  (TYPES_R | 1 << CHANNEL_IS_OPTO | 1 << CHANNEL_IS_CPU)
+#define TYPES_232H  (TYPES_2232 | 1 << CHANNEL_IS_FT1284)
+
+#define HEAD_COMMON \
+        /* Addr 02: Vendor ID, 04: Product ID, 06: release number */ \
+        SET_U16(0x02, vendor_id), \
+        SET_U16(0x04, product_id), \
+        SET_U16(0x06, release_number), \
+        /* Addr 08: Config descriptor, bit 7 always 1 */ \
+        SET_CONST(0x08, 0x80), \
+        ORIF(0x08, self_powered, 0x40), \
+        ORIF(0x08, remote_wakeup, 0x20), \
+        /* Addr 09: Max power consumption: max power = value * 2 mA */ \
+        SET_DIV(0x09, max_power, MAX_POWER_MILLIAMP_PER_UNIT)
+
+static const struct my_eeprom_field head_basic[] = {
+    HEAD_COMMON,
+};
+
+static const struct my_eeprom_field head_iso[] = {
+    HEAD_COMMON,
+    /* Addr 0A: Chip configuration */
+    SET_CONST(0x0A, 0),
+    ORIF(0x0A, in_is_isochronous, 0x01),
+    ORIF(0x0A, out_is_isochronous, 0x02),
+};
+
+static const struct my_eeprom_field fields_bm[] = {
+    BIT(0x0A, use_serial, USE_SERIAL_NUM),
+    SET_U16(0x0C, usb_version),
+    BIT(0x0A, use_usb_version, USE_USB_VERSION_BIT),
+};
+
+static const struct my_eeprom_field fields_2232c[] = {
+    BIT(0x0A, use_serial, USE_SERIAL_NUM),
+    SET_TYPE(0x00, channel_a_type, TYPES_2232),
+    BIT_EQ(0x00, channel_a_driver, DRIVER_VCP, DRIVER_VCP),
+    BIT_EQ(0x00, high_current_a, HIGH_CURRENT_DRIVE, HIGH_CURRENT_DRIVE),
+    SET_TYPE(0x01, channel_b_type, TYPES_2232),
+    BIT_EQ(0x01, channel_b_driver, DRIVER_VCP, DRIVER_VCP),
+    BIT_EQ(0x01, high_current_b, HIGH_CURRENT_DRIVE, HIGH_CURRENT_DRIVE),
+    BIT(0x0A, in_is_isochronous, 0x01),
+    BIT(0x0A, out_is_isochronous, 0x02),
+    BIT(0x0A, suspend_pull_downs, 0x04),
+    BIT(0x0A, use_usb_version, USE_USB_VERSION_BIT),
+    SET_U16(0x0C, usb_version),
+    SET(0x14, chip),
+};
+
+static const struct my_eeprom_field fields_r[] = {
+    BIT(0x0A, use_serial, USE_SERIAL_NUM),
+    SET_TYPE(0x00, channel_a_type, TYPES_R),
+    ORIF_EQ(0x00, high_current, HIGH_CURRENT_DRIVE_R, HIGH_CURRENT_DRIVE_R),
+    ORIF(0x00, external_oscillator, 0x02),
+    SET_CONST(0x01, 0x40),  /* Hard coded Endpoint Size */
+    BIT(0x0A, suspend_pull_downs, 0x04),
+    SET(0x0B, invert),
+    SET_U16(0x0C, usb_version),
+    SET_LIMIT(0x14, cbus_function[0], CBUS_BB_RD, CBUS_TXLED, 0),
+    OR_LIMIT(0x14, cbus_function[1], CBUS_BB_RD, CBUS_RXLED, 4),
+    SET_LIMIT(0x15, cbus_function[2], CBUS_BB_RD, CBUS_TXDEN, 0),
+    OR_LIMIT(0x15, cbus_function[3], CBUS_BB_RD, CBUS_PWREN, 4),
+    SET_LIMIT(0x16, cbus_function[4], CBUS_CLK6, CBUS_SLEEP, 0),
+};
+
+static const struct my_eeprom_field fields_2232h[] = {
+    BIT(0x0A, use_serial, USE_SERIAL_NUM),
+    SET_TYPE(0x00, channel_a_type, TYPES_2232),
+    BIT_EQ(0x00, channel_a_driver, DRIVER_VCP, DRIVER_VCP),
+    SET_TYPE(0x01, channel_b_type, TYPES_2232),
+    BIT_EQ(0x01, channel_b_driver, DRIVER_VCP, DRIVER_VCP),
+    BIT_EQ(0x01, suspend_dbus7, SUSPEND_DBUS7_BIT, SUSPEND_DBUS7_BIT),
+    BIT(0x0A, suspend_pull_downs, 0x04),
+    GROUP(0x0C, 0, 0),
+    GROUP(0x0C, 1, 4),
+    GROUP(0x0D, 2, 0),
+    GROUP(0x0D, 3, 4),
+    SET(0x18, chip),
+};
+
+/* channels C/D drivers in high nibble, no channel type */
+static const struct my_eeprom_field fields_4232h[] = {
+    BIT(0x0A, use_serial, USE_SERIAL_NUM),
+    BIT_EQ(0x00, channel_a_driver, DRIVER_VCP, DRIVER_VCP),
+    BIT_EQ(0x01, channel_b_driver, DRIVER_VCP, DRIVER_VCP),
+    BIT_EQ(0x00, channel_c_driver, DRIVER_VCP, DRIVER_VCP << 4),
+    BIT_EQ(0x01, channel_d_driver, DRIVER_VCP, DRIVER_VCP << 4),
+    BIT(0x0A, suspend_pull_downs, 0x04),
+    BIT(0x0B, channel_a_rs485enable, CHANNEL_IS_RS485 << 0),
+    BIT(0x0B, channel_b_rs485enable, CHANNEL_IS_RS485 << 1),
+    BIT(0x0B, channel_c_rs485enable, CHANNEL_IS_RS485 << 2),
+    BIT(0x0B, channel_d_rs485enable, CHANNEL_IS_RS485 << 3),
+    GROUP(0x0C, 0, 0),
+    GROUP(0x0C, 1, 4),
+    GROUP(0x0D, 2, 0),
+    GROUP(0x0D, 3, 4),
+    SET(0x18, chip),
+};
+
+static const struct my_eeprom_field fields_232h[] = {
+    BIT(0x0A, use_serial, USE_SERIAL_NUM),
+    SET_TYPE(0x00, channel_a_type, TYPES_232H),
+    BIT_EQ(0x00, channel_a_driver, DRIVER_VCP, DRIVER_VCPH),
+    BIT(0x01, powersave, POWER_SAVE_DISABLE_H),
+    BIT(0x0A, suspend_pull_downs, 0x04),
+    BIT(0x01, clock_polarity, FT1284_CLK_IDLE_STATE),
+    BIT(0x01, data_order, FT1284_DATA_LSB),
+    BIT(0x01, flow_control, FT1284_FLOW_CONTROL),
+    GROUP(0x0C, 0, 0),
+    GROUP(0x0D, 1, 0),
+    CBUSH(0x18, 0),
+    CBUSH(0x19, 1),
+    CBUSH(0x1A, 2),
+    CBUSH(0x1B, 3),
+    CBUSH(0x1C, 4),
+    SET(0x1E, chip),
+};
+
+static const struct my_eeprom_field fields_230x[] = {
+    BIT(0x0A, use_serial, USE_SERIAL_NUM),
+    SET_CONST(0x00, 0x80),  /* Actually, leave the default value */
+    /* DBUS drive 4mA, CBUS drive 4 mA like factory default */
+    SET_CONST(0x0C, 0),
+    SET(0x1A, cbus_function[0]),
+    SET(0x1B, cbus_function[1]),
+    SET(0x1C, cbus_function[2]),
+    SET(0x1D, cbus_function[3]),
+    SET(0x1E, cbus_function[4]),
+    SET(0x1F, cbus_function[5]),
+    SET(0x20, cbus_function[6]),
+    SET(0x0B, invert),
+};
+
+#define TABLE(t)    t, (int)(sizeof(t) / sizeof(t[0]))
+
+static const struct my_eeprom_layout layouts[] = {
+    [TYPE_AM] = {
+        .type = TYPE_AM, .name = "AM",
+        .user_area = 96, .string_start = 0x94, .free_start = 0x14,
+        .head = TABLE(head_basic),
+    },
+    [TYPE_BM] = {
+        .type = TYPE_BM, .name = "BM",
+        .user_area = 96, .string_start = 0x94, .free_start = 0x14,
+        .head = TABLE(head_iso), .fields = TABLE(fields_bm),
+    },
+    /* two extra config bytes and 4 bytes PnP stuff */
+    [TYPE_2232C] = {
+        .type = TYPE_2232C, .name = "2232C",
+        .user_area = 90, .string_start = 0x96, .free_start = 0x15,
+        .pnp = 1,
+        .head = TABLE(head_iso), .fields = TABLE(fields_2232c),
+    },
+    [TYPE_R] = {
+        .type = TYPE_R, .name = "R",
+        .user_area = 96, .string_start = 0x98, .free_start = 0x17,
+        .pnp = 1,
+        .head = TABLE(head_iso), .fields = TABLE(fields_r),
+    },
+    /* six extra config bytes + 4 bytes PnP stuff, user area extended on
+     * 256 bytes EEPROM (93C56/66)
+     */
+    [TYPE_2232H] = {
+        .type = TYPE_2232H, .name = "2232H",
+        .user_area = 86, .user_area_ext = 128,
+        .string_start = 0x9a, .free_start = 0x19, .pnp = 1,
+        .head = TABLE(head_iso), .fields = TABLE(fields_2232h),
+    },
+    [TYPE_4232H] = {
+        .type = TYPE_4232H, .name = "4232H",
+        .user_area = 86, .user_area_ext = 128,
+        .string_start = 0x9a, .free_start = 0x19, .pnp = 1,
+        .head = TABLE(head_iso), .fields = TABLE(fields_4232h),
+    },
+    [TYPE_232H] = {
+        .type = TYPE_232H, .name = "232H",
+        .user_area = 80, .string_start = 0xa0, .free_start = 0x1f,
+        .pnp = 1,
+        .head = TABLE(head_iso), .fields = TABLE(fields_232h),
+    },
+    /* four extra config bytes + 4 bytes PnP stuff. MTP has a reserved
+     * section (0x80-0x9f) which can't be written, a user section not in
+     * checksum and factory data which must be read back for checksum
+     */
+    [TYPE_230X] = {
+        .type = TYPE_230X, .name = "230X",
+        .user_area = 88, .string_start = 0xa0, .free_start = 0x21,
+        .pnp = 1, .keep_start = 0x80, .keep_end = 0xa0,
+        .csum_skip_start = 0x12, .csum_skip_end = 0x40,
+        .factory_start = 0x40, .factory_end = 0x50,
+        .head = TABLE(head_basic), .fields = TABLE(fields_230x),
+    },
+};
+
+/* struct ftdi_eeprom member of ftdi_set_eeprom_value() fields stored in
+ * config bytes (not strings)
+ */
+static const struct {
+    enum ftdi_eeprom_value value;
+    short src;
+} value_srcs[] = {
+    {VENDOR_ID, E(vendor_id)},
+    {PRODUCT_ID, E(product_id)},
+    {SELF_POWERED, E(self_powered)},
+    {REMOTE_WAKEUP, E(remote_wakeup)},
+    {SUSPEND_DBUS7, E(suspend_dbus7)},
+    {IN_IS_ISOCHRONOUS, E(in_is_isochronous)},
+    {OUT_IS_ISOCHRONOUS, E(out_is_isochronous)},
+    {SUSPEND_PULL_DOWNS, E(suspend_pull_downs)},
+    {USE_SERIAL, E(use_serial)},
+    {USB_VERSION, E(usb_version)},
+    {USE_USB_VERSION, E(use_usb_version)},
+    {MAX_POWER, E(max_power)},
+    {CHANNEL_A_TYPE, E(channel_a_type)},
+    {CHANNEL_B_TYPE, E(channel_b_type)},
+    {CHANNEL_A_DRIVER, E(channel_a_driver)},
+    {CHANNEL_B_DRIVER, E(channel_b_driver)},
+    {CHANNEL_C_DRIVER, E(channel_c_driver)},
+    {CHANNEL_D_DRIVER, E(channel_d_driver)},
+    {CBUS_FUNCTION_0, E(cbus_function[0])},
+    {CBUS_FUNCTION_1, E(cbus_function[1])},
+    {CBUS_FUNCTION_2, E(cbus_function[2])},
+    {CBUS_FUNCTION_3, E(cbus_function[3])},
+    {CBUS_FUNCTION_4, E(cbus_function[4])},
+    {CBUS_FUNCTION_5, E(cbus_function[5])},
+    {CBUS_FUNCTION_6, E(cbus_function[6])},
+    {CBUS_FUNCTION_7, E(cbus_function[7])},
+    {CBUS_FUNCTION_8, E(cbus_function[8])},
+    {CBUS_FUNCTION_9, E(cbus_function[9])},
+    {HIGH_CURRENT, E(high_current)},
+    {HIGH_CURRENT_A, E(high_current_a)},
+    {HIGH_CURRENT_B, E(high_current_b)},
+    {INVERT, E(invert)},
+    {GROUP0_DRIVE, E(group0_drive)},
+    {GROUP0_SCHMITT, E(group0_schmitt)},
+    {GROUP0_SLEW, E(group0_slew)},
+    {GROUP1_DRIVE, E(group1_drive)},
+    {GROUP1_SCHMITT, E(group1_schmitt)},
+    {GROUP1_SLEW, E(group1_slew)},
+    {GROUP2_DRIVE, E(group2_drive)},
+    {GROUP2_SCHMITT, E(group2_schmitt)},
+    {GROUP2_SLEW, E(group2_slew)},
+    {GROUP3_DRIVE, E(group3_drive)},
+    {GROUP3_SCHMITT, E(group3_schmitt)},
+    {GROUP3_SLEW, E(group3_slew)},
+    {POWER_SAVE, E(powersave)},
+    {CLOCK_POLARITY, E(clock_polarity)},
+    {DATA_ORDER, E(data_order)},
+    {FLOW_CONTROL, E(flow_control)},
+    {CHANNEL_A_RS485, E(channel_a_rs485enable)},
+    {CHANNEL_B_RS485, E(channel_b_rs485enable)},
+    {CHANNEL_C_RS485, E(channel_c_rs485enable)},
+    {CHANNEL_D_RS485, E(channel_d_rs485enable)},
+    {RELEASE_NUMBER, E(release_number)},
+    {EXTERNAL_OSCILLATOR, E(external_oscillator)},
+};
+
+int my_ftdi_eeprom_value_src(enum ftdi_eeprom_value value)
+{
+    unsigned int i;
+
+    for (i = 0; i < sizeof(value_srcs) / sizeof(value_srcs[0]); i++)
+        if (value_srcs[i].value == value)
+            return value_srcs[i].src;
+    return -1;
+}
+
+/**
+    Bits of output[f->addr] owned by a field, the other bits of the byte
+    belong to other fields.
+*/
+unsigned char my_eeprom_field_mask(const struct my_eeprom_field *f)
+{
+    unsigned int m = 0, v;
+
+    if (f->op == MY_OP_BIT || f->op == MY_OP_ORIF)
+        return f->bits;
+
+    switch (f->enc)
+    {
+        case MY_ENC_LIMIT:
+            /* smallest bit field holding both limit and default */
+            m = f->arg | f->arg2;
+            m |= m >> 1;
+            m |= m >> 2;
+            m |= m >> 4;
+            m |= m >> 8;
+            break;
+        case MY_ENC_ONEOF:
+            for (v = 0; v < 16; v++)
+                if ((f->arg >> v) & 1)
+                    m |= v;
+            break;
+        default:
+            m = 0xff;
+            break;
+    }
+    return (m << f->shift) & 0xff;
+}
+
+const struct my_eeprom_layout *my_ftdi_eeprom_layout(enum ftdi_chip_type type)
+{
+    if ((unsigned int)type >= sizeof(layouts) / sizeof(layouts[0]) ||
+        layouts[type].name == NULL)
+        return NULL;
+    return &layouts[type];
+}
+
+void my_ftdi_eeprom_encode(const struct my_eeprom_field *f, int nb,
+        const struct ftdi_eeprom *eeprom, unsigned char *output)
+{
+    const char *base = (const char *)eeprom;
+    int i, src, value = 0;
+
+    for (i = 0; i < nb; i++, f++)
+    {
+        src = (f->src < 0) ? 0 : *(const int *)(base + f->src);
+
+        switch (f->enc)
+        {
+            case MY_ENC_CONST:
+                value = f->arg;
+                break;
+            case MY_ENC_LO:
+                value = src & 0xff;
+                break;
+            case MY_ENC_HI:
+                value = (src >> 8) & 0xff;
+                break;
+            case MY_ENC_DIV:
+                value = src / f->arg;
+                break;
+            case MY_ENC_LIMIT:
+                value = (src > f->arg) ? f->arg2 : src;
+                break;
+            case MY_ENC_ONEOF:
+                value = (unsigned char)src;
+                if (value >= 16 || !((f->arg >> value) & 1))
+                    value = 0;
+                break;
+            case MY_ENC_NZ:
+                value = (src != 0);
+                break;
+            case MY_ENC_EQ:
+                value = (src == f->arg);
+                break;
+        }
+
+        switch (f->op)
+        {
+            case MY_OP_SET:
+                output[f->addr] = value << f->shift;
+                break;
+            case MY_OP_OR:
+                output[f->addr] |= value << f->shift;
+                break;
+            case MY_OP_BIT:
+                if (value)
+                    output[f->addr] |= f->bits;
+                else
+                    output[f->addr] &= ~f->bits;
+                break;
+            case MY_OP_ORIF:
+                if (value)
+                    output[f->addr] |= f->bits;
+                break;
+        }
+    }
+}
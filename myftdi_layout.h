@@ -0,0 +1,72 @@
+#ifndef MY_FTDI_LAYOUT_H_
+#define MY_FTDI_LAYOUT_H_
+#include <ftdi.h>
+
+/* how a field is stored: output[addr] is assigned, or-ed with the encoded
+ * value, or bits are set/cleared depending on a condition
+ */
+enum my_eeprom_op {
+    MY_OP_SET,      /* output = value << shift */
+    MY_OP_OR,       /* output |= value << shift */
+    MY_OP_BIT,      /* cond ? output |= bits : output &= ~bits */
+    MY_OP_ORIF,     /* cond ? output |= bits */
+};
+
+/* how the value (or condition) is computed from struct ftdi_eeprom */
+enum my_eeprom_enc {
+    MY_ENC_CONST,   /* value = arg */
+    MY_ENC_LO,      /* value = src & 0xff */
+    MY_ENC_HI,      /* value = src >> 8 */
+    MY_ENC_DIV,     /* value = src / arg */
+    MY_ENC_LIMIT,   /* value = (src > arg) ? arg2 : src */
+    MY_ENC_ONEOF,   /* value = src if bit src of arg set, else 0 */
+    MY_ENC_NZ,      /* cond = src != 0 */
+    MY_ENC_EQ,      /* cond = src == arg */
+};
+
+struct my_eeprom_field {
+    unsigned char addr;
+    unsigned char op;       /* enum my_eeprom_op */
+    unsigned char enc;      /* enum my_eeprom_enc */
+    unsigned char shift;
+    unsigned char bits;     /* MY_OP_BIT and MY_OP_ORIF */
+    short src;              /* offset in struct ftdi_eeprom, -1: none */
+    unsigned short arg;
+    unsigned short arg2;
+};
+
+/* EEPROM layout of a chip family */
+struct my_eeprom_layout {
+    enum ftdi_chip_type type;
+    const char *name;
+    int user_area;          /* bytes for strings on 128 bytes EEPROM */
+    int user_area_ext;      /* extra bytes on 256 bytes EEPROM, always
+                               taken into account by my_ftdi_eeprom_build */
+    unsigned char string_start;     /* before wrap on 128 bytes EEPROM */
+    unsigned char free_start;       /* first byte not used by config */
+    unsigned char pnp;      /* legacy port name and PnP after strings */
+    /* bytes [keep_start, keep_end[ are reserved, never cleared */
+    unsigned char keep_start, keep_end;
+    /* words [csum_skip_start, csum_skip_end[ are not in checksum */
+    unsigned char csum_skip_start, csum_skip_end;
+    /* words [factory_start, factory_end[ are read from device for checksum */
+    unsigned char factory_start, factory_end;
+    /* fields written before strings, then after strings */
+    const struct my_eeprom_field *head;
+    int nb_head;
+    const struct my_eeprom_field *fields;
+    int nb_fields;
+};
+
+/* layout of chip type, NULL if unknown */
+const struct my_eeprom_layout *my_ftdi_eeprom_layout(enum ftdi_chip_type type);
+/* offset in struct ftdi_eeprom of a config field, -1 for strings,
+ * user data and unknown values
+ */
+int my_ftdi_eeprom_value_src(enum ftdi_eeprom_value value);
+/* bits of output[f->addr] written by f */
+unsigned char my_eeprom_field_mask(const struct my_eeprom_field *f);
+/* encode fields into output */
+void my_ftdi_eeprom_encode(const struct my_eeprom_field *f, int nb,
+        const struct ftdi_eeprom *eeprom, unsigned char *output);
+#endif
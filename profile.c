@@ -0,0 +1,464 @@
+/* profile.c
+ * board profiles: EEPROM fields to patch and devices they apply to
+ *
+ * (C) 2015-2019 by Gwenhael Goavec-Merou <gwen@trabucayre.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <ftdi.h>
+#include "ftdi_i.h"
+#include "myftdi_image.h"
+#include "fix.h"
+#include "profile.h"
+
+static const struct board_profile profile_ecp5_evn = {
+	.name = "ecp5-evn",
+	.vendor_id = -1,
+	.product_id = -1,
+	.chip_type = -1,
+	.nb_patches = 6,
+	.patches = {
+		/* GROUP2 (BL/BDBUSx) */
+		{GROUP2_DRIVE, DRIVE_4MA, "GROUP2_DRIVE"},
+		{GROUP2_SLEW, SLOW_SLEW, "GROUP2_SLEW"},
+		/* GROUP3 (BH/BCBUSx) */
+		{GROUP3_DRIVE, DRIVE_4MA, "GROUP3_DRIVE"},
+		{GROUP3_SLEW, SLOW_SLEW, "GROUP3_SLEW"},
+		/* INTERFACE_B as UART VCP */
+		{CHANNEL_B_TYPE, CHANNEL_IS_UART, "CHANNEL_B_TYPE"},
+		{CHANNEL_B_DRIVER, DRIVER_VCP, "CHANNEL_B_DRIVER"},
+	},
+};
+
+const struct board_profile *profile_builtin(void)
+{
+	return &profile_ecp5_evn;
+}
+
+/* allowed values of a field */
+enum profile_kind {
+	KIND_BOOL,
+	KIND_U16,
+	KIND_POWER,	/* mA */
+	KIND_CHANNEL,
+	KIND_DRIVER,
+	KIND_DRIVE,
+	KIND_SLEW,
+	KIND_SCHMITT,
+};
+
+#define CHIP(t)		(1 << (t))
+#define CHIPS_ALL	(~0)
+#define CHIPS_H		(CHIP(TYPE_2232H) | CHIP(TYPE_4232H) | CHIP(TYPE_232H))
+#define CHIPS_DUAL_QUAD	(CHIP(TYPE_2232H) | CHIP(TYPE_4232H))
+
+static const struct profile_field {
+	const char *name;
+	enum ftdi_eeprom_value field;
+	enum profile_kind kind;
+	int chips;		/* CHIP() mask of chips having this field */
+} profile_fields[] = {
+	{"VENDOR_ID", VENDOR_ID, KIND_U16, CHIPS_ALL},
+	{"PRODUCT_ID", PRODUCT_ID, KIND_U16, CHIPS_ALL},
+	{"SELF_POWERED", SELF_POWERED, KIND_BOOL, CHIPS_ALL},
+	{"REMOTE_WAKEUP", REMOTE_WAKEUP, KIND_BOOL, CHIPS_ALL},
+	{"SUSPEND_PULL_DOWNS", SUSPEND_PULL_DOWNS, KIND_BOOL, CHIPS_ALL},
+	{"USE_SERIAL", USE_SERIAL, KIND_BOOL, CHIPS_ALL},
+	{"MAX_POWER", MAX_POWER, KIND_POWER, CHIPS_ALL},
+	{"CHANNEL_A_TYPE", CHANNEL_A_TYPE, KIND_CHANNEL,
+		CHIP(TYPE_2232C) | CHIP(TYPE_2232H) | CHIP(TYPE_232H)},
+	{"CHANNEL_B_TYPE", CHANNEL_B_TYPE, KIND_CHANNEL,
+		CHIP(TYPE_2232C) | CHIP(TYPE_2232H)},
+	{"CHANNEL_A_DRIVER", CHANNEL_A_DRIVER, KIND_DRIVER, CHIPS_ALL},
+	{"CHANNEL_B_DRIVER", CHANNEL_B_DRIVER, KIND_DRIVER,
+		CHIP(TYPE_2232C) | CHIPS_DUAL_QUAD},
+	{"CHANNEL_C_DRIVER", CHANNEL_C_DRIVER, KIND_DRIVER, CHIP(TYPE_4232H)},
+	{"CHANNEL_D_DRIVER", CHANNEL_D_DRIVER, KIND_DRIVER, CHIP(TYPE_4232H)},
+	{"GROUP0_DRIVE", GROUP0_DRIVE, KIND_DRIVE, CHIPS_H},
+	{"GROUP0_SLEW", GROUP0_SLEW, KIND_SLEW, CHIPS_H},
+	{"GROUP0_SCHMITT", GROUP0_SCHMITT, KIND_SCHMITT, CHIPS_H},
+	{"GROUP1_DRIVE", GROUP1_DRIVE, KIND_DRIVE, CHIPS_H},
+	{"GROUP1_SLEW", GROUP1_SLEW, KIND_SLEW, CHIPS_H},
+	{"GROUP1_SCHMITT", GROUP1_SCHMITT, KIND_SCHMITT, CHIPS_H},
+	{"GROUP2_DRIVE", GROUP2_DRIVE, KIND_DRIVE, CHIPS_DUAL_QUAD},
+	{"GROUP2_SLEW", GROUP2_SLEW, KIND_SLEW, CHIPS_DUAL_QUAD},
+	{"GROUP2_SCHMITT", GROUP2_SCHMITT, KIND_SCHMITT, CHIPS_DUAL_QUAD},
+	{"GROUP3_DRIVE", GROUP3_DRIVE, KIND_DRIVE, CHIPS_DUAL_QUAD},
+	{"GROUP3_SLEW", GROUP3_SLEW, KIND_SLEW, CHIPS_DUAL_QUAD},
+	{"GROUP3_SCHMITT", GROUP3_SCHMITT, KIND_SCHMITT, CHIPS_DUAL_QUAD},
+};
+
+#define NB_FIELDS (sizeof(profile_fields) / sizeof(profile_fields[0]))
+
+static const struct {
+	const char *name;
+	int value;
+	enum profile_kind kind;
+} profile_symbols[] = {
+	{"CHANNEL_IS_UART", CHANNEL_IS_UART, KIND_CHANNEL},
+	{"CHANNEL_IS_FIFO", CHANNEL_IS_FIFO, KIND_CHANNEL},
+	{"CHANNEL_IS_OPTO", CHANNEL_IS_OPTO, KIND_CHANNEL},
+	{"CHANNEL_IS_CPU", CHANNEL_IS_CPU, KIND_CHANNEL},
+	{"CHANNEL_IS_FT1284", CHANNEL_IS_FT1284, KIND_CHANNEL},
+	{"DRIVER_D2XX", 0, KIND_DRIVER},
+	{"DRIVER_VCP", DRIVER_VCP, KIND_DRIVER},
+	{"DRIVE_4MA", DRIVE_4MA, KIND_DRIVE},
+	{"DRIVE_8MA", DRIVE_8MA, KIND_DRIVE},
+	{"DRIVE_12MA", DRIVE_12MA, KIND_DRIVE},
+	{"DRIVE_16MA", DRIVE_16MA, KIND_DRIVE},
+	{"FAST_SLEW", 0, KIND_SLEW},
+	{"SLOW_SLEW", SLOW_SLEW, KIND_SLEW},
+	{"NO_SCHMITT", 0, KIND_SCHMITT},
+	{"IS_SCHMITT", IS_SCHMITT, KIND_SCHMITT},
+};
+
+#define NB_SYMBOLS (sizeof(profile_symbols) / sizeof(profile_symbols[0]))
+
+static const struct profile_field *profile_field_find(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < NB_FIELDS; i++)
+		if (strcasecmp(name, profile_fields[i].name) == 0)
+			return &profile_fields[i];
+	return NULL;
+}
+
+/* value of a field from a number or a symbol of the field kind */
+static int profile_value(const struct profile_field *f, const char *str,
+		int *value)
+{
+	unsigned int i;
+	char *end;
+	long v;
+
+	for (i = 0; i < NB_SYMBOLS; i++) {
+		if (strcasecmp(str, profile_symbols[i].name) != 0)
+			continue;
+		if (profile_symbols[i].kind != f->kind)
+			return -1;
+		*value = profile_symbols[i].value;
+		return 0;
+	}
+
+	v = strtol(str, &end, 0);
+	if (*str == '\0' || *end != '\0')
+		return -1;
+
+	switch (f->kind) {
+	case KIND_BOOL:
+		if (v != 0 && v != 1)
+			return -1;
+		break;
+	case KIND_U16:
+		if (v < 0 || v > 0xffff)
+			return -1;
+		break;
+	case KIND_POWER:
+		if (v < 0 || v > 500)
+			return -1;
+		break;
+	default:
+		/* numeric value must be one of kind symbols */
+		for (i = 0; i < NB_SYMBOLS; i++)
+			if (profile_symbols[i].kind == f->kind &&
+			    profile_symbols[i].value == v)
+				break;
+		if (i == NB_SYMBOLS)
+			return -1;
+	}
+	*value = v;
+	return 0;
+}
+
+static char *profile_trim(char *s)
+{
+	char *end;
+
+	while (isspace((unsigned char)*s))
+		s++;
+	end = s + strlen(s);
+	while (end > s && isspace((unsigned char)end[-1]))
+		*--end = '\0';
+	return s;
+}
+
+static int profile_parse_error(const char *file, int lineno, const char *msg,
+		const char *arg)
+{
+	printf("%s:%d: %s%s%s\n", file, lineno, msg, arg ? " " : "",
+	       arg ? arg : "");
+	return -1;
+}
+
+/* match key (lowercase) */
+static int profile_set_key(struct board_profile *prof, const char *key,
+		const char *val)
+{
+	char *end;
+
+	if (strcmp(key, "vid") == 0 || strcmp(key, "pid") == 0) {
+		long v = strtol(val, &end, 0);
+
+		if (*val == '\0' || *end != '\0' || v < 0 || v > 0xffff)
+			return -1;
+		if (key[0] == 'v')
+			prof->vendor_id = v;
+		else
+			prof->product_id = v;
+	} else if (strcmp(key, "chip") == 0) {
+		if ((prof->chip_type = fix_chip_type(val)) < 0)
+			return -1;
+	} else if (strcmp(key, "product") == 0) {
+		snprintf(prof->product, sizeof(prof->product), "%s", val);
+	} else if (strcmp(key, "serial") == 0) {
+		snprintf(prof->serial, sizeof(prof->serial), "%s", val);
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+static int profile_set_field(struct board_profile *prof, const char *key,
+		const char *val, const char *file, int lineno)
+{
+	const struct profile_field *f = profile_field_find(key);
+	struct profile_patch *p;
+	int i, value;
+
+	if (f == NULL)
+		return profile_parse_error(file, lineno, "unknown field", key);
+	if (profile_value(f, val, &value) != 0)
+		return profile_parse_error(file, lineno, "bad value for", key);
+	for (i = 0; i < prof->nb_patches; i++)
+		if (prof->patches[i].field == f->field)
+			return profile_parse_error(file, lineno,
+						   "duplicate field", key);
+	if (prof->nb_patches == PROFILE_MAX_PATCHES)
+		return profile_parse_error(file, lineno, "too many fields",
+					   NULL);
+	p = &prof->patches[prof->nb_patches++];
+	p->field = f->field;
+	p->value = value;
+	p->name = f->name;
+	return 0;
+}
+
+/* checks needing the whole profile */
+static int profile_check(const struct board_profile *prof, const char *file,
+		int lineno)
+{
+	const struct profile_field *f;
+	int i;
+
+	if (prof->nb_patches == 0)
+		return profile_parse_error(file, lineno, "no field in profile",
+					   prof->name);
+	if (prof->chip_type < 0)
+		return 0;
+	for (i = 0; i < prof->nb_patches; i++) {
+		f = profile_field_find(prof->patches[i].name);
+		if (!(f->chips & CHIP(prof->chip_type)))
+			return profile_parse_error(file, lineno,
+					"field not available on chip",
+					f->name);
+	}
+	return 0;
+}
+
+static const struct board_profile *profile_find_list(
+		const struct board_profile *list, const char *name)
+{
+	for (; list; list = list->next)
+		if (strcmp(list->name, name) == 0)
+			return list;
+	return NULL;
+}
+
+void profile_free(struct board_profile *list)
+{
+	struct board_profile *next;
+
+	for (; list; list = next) {
+		next = list->next;
+		free(list);
+	}
+}
+
+int profile_load(const char *file, struct board_profile **list)
+{
+	struct board_profile *head = NULL, **tail = &head, *prof = NULL;
+	char buf[256], *line, *key, *val;
+	int lineno = 0, start = 0, ret = -1;
+	FILE *fd;
+
+	if ((fd = fopen(file, "r")) == NULL) {
+		perror(file);
+		return -1;
+	}
+
+	while (fgets(buf, sizeof(buf), fd) != NULL) {
+		lineno++;
+		line = profile_trim(buf);
+		if (line[0] == '\0' || line[0] == '#')
+			continue;
+
+		if (line[0] == '[') {
+			if (prof && profile_check(prof, file, start) != 0)
+				goto out;
+			key = strchr(line, ']');
+			if (key == NULL || key[1] != '\0' || key == line + 1) {
+				profile_parse_error(file, lineno,
+						    "bad profile name", line);
+				goto out;
+			}
+			*key = '\0';
+			/* built-in profiles may be overridden */
+			if (profile_find_list(head, line + 1) != NULL ||
+			    profile_find_list(*list, line + 1) != NULL) {
+				profile_parse_error(file, lineno,
+						    "duplicate profile",
+						    line + 1);
+				goto out;
+			}
+			if ((prof = calloc(1, sizeof(*prof))) == NULL) {
+				profile_parse_error(file, lineno,
+						    "out of memory", NULL);
+				goto out;
+			}
+			snprintf(prof->name, sizeof(prof->name), "%s",
+				 line + 1);
+			prof->vendor_id = prof->product_id = -1;
+			prof->chip_type = -1;
+			*tail = prof;
+			tail = &prof->next;
+			start = lineno;
+			continue;
+		}
+
+		if ((val = strchr(line, '=')) == NULL) {
+			profile_parse_error(file, lineno, "expected key = value",
+					    NULL);
+			goto out;
+		}
+		*val++ = '\0';
+		key = profile_trim(line);
+		val = profile_trim(val);
+		if (prof == NULL) {
+			profile_parse_error(file, lineno,
+					    "key outside of a profile", key);
+			goto out;
+		}
+		/* lowercase: match key, uppercase: EEPROM field */
+		if (islower((unsigned char)key[0])) {
+			if (profile_set_key(prof, key, val) != 0) {
+				profile_parse_error(file, lineno,
+						    "bad match key", key);
+				goto out;
+			}
+		} else if (profile_set_field(prof, key, val, file,
+					     lineno) != 0) {
+			goto out;
+		}
+	}
+
+	if (prof == NULL) {
+		profile_parse_error(file, lineno, "no profile", NULL);
+		goto out;
+	}
+	if (profile_check(prof, file, start) != 0)
+		goto out;
+
+	/* append only fully valid files */
+	for (tail = list; *tail; tail = &(*tail)->next)
+		;
+	*tail = head;
+	head = NULL;
+	ret = 0;
+out:
+	profile_free(head);
+	fclose(fd);
+	return ret;
+}
+
+const struct board_profile *profile_find(const struct board_profile *list,
+		const char *name)
+{
+	const struct board_profile *prof = profile_find_list(list, name);
+
+	if (prof == NULL && strcmp(profile_ecp5_evn.name, name) == 0)
+		prof = &profile_ecp5_evn;
+	return prof;
+}
+
+const struct board_profile *profile_match(const struct board_profile *list,
+		struct ftdi_context *ftdi)
+{
+	struct ftdi_eeprom *eeprom = ftdi->eeprom;
+
+	for (; list; list = list->next) {
+		if (list->vendor_id >= 0 && list->vendor_id != eeprom->vendor_id)
+			continue;
+		if (list->product_id >= 0 &&
+		    list->product_id != eeprom->product_id)
+			continue;
+		if (list->chip_type >= 0 && list->chip_type != (int)ftdi->type)
+			continue;
+		if (list->product[0] && (eeprom->product == NULL ||
+		    strcmp(list->product, eeprom->product) != 0))
+			continue;
+		if (list->serial[0] && (eeprom->serial == NULL ||
+		    strncmp(list->serial, eeprom->serial,
+			    strlen(list->serial)) != 0))
+			continue;
+		return list;
+	}
+	return NULL;
+}
+
+int profile_apply(const struct board_profile *prof, struct ftdi_context *ftdi,
+		const struct profile_patch **failed)
+{
+	int i, ret;
+
+	for (i = 0; i < prof->nb_patches; i++) {
+		ret = ftdi_set_eeprom_value(ftdi, prof->patches[i].field,
+					    prof->patches[i].value);
+		if (ret != 0) {
+			*failed = &prof->patches[i];
+			return ret;
+		}
+	}
+	return 0;
+}
+
+int profile_apply_raw(const struct board_profile *prof,
+		struct my_eeprom_image *img,
+		const struct profile_patch **failed)
+{
+	int i;
+
+	for (i = 0; i < prof->nb_patches; i++) {
+		if (my_eeprom_image_patch(img, prof->patches[i].field,
+					  prof->patches[i].value) < 0) {
+			*failed = &prof->patches[i];
+			return -1;
+		}
+	}
+	return 0;
+}
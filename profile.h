@@ -0,0 +1,60 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+#include <ftdi.h>
+
+struct my_eeprom_image;
+
+#define PROFILE_NAME_LEN 32
+#define PROFILE_MAX_PATCHES 32
+
+/* one ftdi_set_eeprom_value() call */
+struct profile_patch {
+	enum ftdi_eeprom_value field;
+	int value;
+	const char *name;	/* field name, for error messages */
+};
+
+/* board EEPROM fix: match keys (-1/empty: any) and patch table */
+struct board_profile {
+	char name[PROFILE_NAME_LEN];
+	int vendor_id;		/* as decoded from EEPROM */
+	int product_id;
+	int chip_type;		/* enum ftdi_chip_type */
+	char product[64];	/* product string, exact */
+	char serial[64];	/* serial number prefix */
+	int nb_patches;
+	struct profile_patch patches[PROFILE_MAX_PATCHES];
+	struct board_profile *next;
+};
+
+/* fix for Lattice ECP5 and CrossLink-NX evaluation boards, matches any
+ * device: interface B as UART VCP, BDBUS/BCBUS drive 4mA slow slew
+ */
+const struct board_profile *profile_builtin(void);
+
+/* parse a profile file, every profile is validated (known fields, values
+ * in range, no duplicate, fields available on chip) and appended to *list.
+ * return 0 or -1 with error displayed
+ */
+int profile_load(const char *file, struct board_profile **list);
+void profile_free(struct board_profile *list);
+/* search by name in list then built-in profiles: a loaded profile
+ * overrides the built-in one with the same name
+ */
+const struct board_profile *profile_find(const struct board_profile *list,
+		const char *name);
+/* first profile of list matching decoded EEPROM of ftdi */
+const struct board_profile *profile_match(const struct board_profile *list,
+		struct ftdi_context *ftdi);
+/* apply the whole patch table, return 0 or ftdi_set_eeprom_value() error
+ * with *failed pointing to the faulty entry
+ */
+int profile_apply(const struct board_profile *prof, struct ftdi_context *ftdi,
+		const struct profile_patch **failed);
+/* same in the raw image: only bits of the fields change. return -1
+ * with *failed set when a field is not stored in config bytes
+ */
+int profile_apply_raw(const struct board_profile *prof,
+		struct my_eeprom_image *img,
+		const struct profile_patch **failed);
+#endif
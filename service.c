@@ -0,0 +1,561 @@
+/* service.c
+ * provisioning requests from a UNIX socket, queued per device
+ *
+ * (C) 2015-2019 by Gwenhael Goavec-Merou <gwen@trabucayre.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <ftdi.h>
+#include "ftdi_i.h"
+#include "fix.h"
+#include "sim.h"
+#include "devindex.h"
+#include "libfixft.h"
+#include "workq.h"
+#include "metrics.h"
+#include "service.h"
+
+enum svc_op {
+	SVC_AUDIT,
+	SVC_FIX,
+	SVC_FLASH,
+};
+
+struct svc_job {
+	int op;			/* enum svc_op */
+	char image[PATH_MAX];	/* SVC_FLASH */
+	int waiters;		/* clients waiting for the result */
+	int done;
+	int ret;
+	struct fix_result res;
+	struct svc_job *next;	/* device queue */
+};
+
+/* jobs of one device run one at a time, in arrival order */
+struct svc_device {
+	char path[32];		/* topology path or sim-N */
+	struct svc_job *head;
+	struct svc_job *tail;
+	int scheduled;		/* in run queue or running */
+	struct svc_device *next;
+};
+
+struct service {
+	struct fixft_ctx *ctx;		/* shared by all workers */
+	const struct sim_config *sim;
+	const struct fix_config *cfg;
+	int vendor_id;
+	int product_id;
+	struct workq runq;		/* svc_device with queued jobs */
+	pthread_mutex_t lock;		/* devices, jobs, counters, log */
+	pthread_cond_t cond;		/* job done or client gone */
+	struct svc_device *devices;
+	int clients;
+	int stopped;
+	int runs;
+	int coalesced;
+	int failed;
+};
+
+struct svc_client {
+	struct service *svc;
+	int fd;
+};
+
+static volatile sig_atomic_t service_stop;
+
+static void service_signal(int sig)
+{
+	(void)sig;
+	service_stop = 1;
+}
+
+static struct svc_device *service_device(struct service *svc,
+		const char *path)
+{
+	struct svc_device *dev;
+
+	for (dev = svc->devices; dev; dev = dev->next)
+		if (strcmp(dev->path, path) == 0)
+			return dev;
+	if ((dev = calloc(1, sizeof(*dev))) == NULL)
+		return NULL;
+	snprintf(dev->path, sizeof(dev->path), "%s", path);
+	dev->next = svc->devices;
+	svc->devices = dev;
+	return dev;
+}
+
+static int service_load_image(const char *file, unsigned char *buf)
+{
+	FILE *fd;
+	int size;
+
+	if ((fd = fopen(file, "rb")) == NULL)
+		return -1;
+	size = fread(buf, 1, FTDI_MAX_EEPROM_SIZE, fd);
+	fclose(fd);
+	return (size == 0x80 || size == FTDI_MAX_EEPROM_SIZE) ? size : -1;
+}
+
+static void service_run_job(struct service *svc, struct svc_device *dev,
+		struct svc_job *job)
+{
+	struct fix_config cfg = *svc->cfg;
+	struct fix_result *res = &job->res;
+	struct fixft_session *s;
+	unsigned char image[FTDI_MAX_EEPROM_SIZE];
+	double start = fix_now_ms();
+	int size = 0;
+
+	res->status = FIX_FAILED;
+	snprintf(res->path, sizeof(res->path), "%s", dev->path);
+	cfg.decode_verbose = 0;
+	if (job->op == SVC_AUDIT) {
+		cfg.audit = 1;
+		cfg.dont_write = 1;
+		cfg.passive = 1;
+	}
+	if (job->op == SVC_FLASH &&
+	    (size = service_load_image(job->image, image)) < 0) {
+		snprintf(res->msg, sizeof(res->msg), "%.96s: invalid image",
+			 job->image);
+		job->ret = -1;
+		return;
+	}
+
+	if (svc->sim)
+		s = fixft_open_sim(svc->sim, atoi(dev->path + 4));
+	else
+		s = fixft_open_path(svc->ctx, dev->path, cfg.passive);
+	res->phase_ms[FIX_PHASE_OPEN] = fix_now_ms() - start;
+	if (s == NULL) {
+		snprintf(res->msg, sizeof(res->msg), "open failed");
+		job->ret = -1;
+		return;
+	}
+	fixft_set_config(s, &cfg);
+	if (job->op == SVC_FLASH)
+		job->ret = fixft_flash(s, image, size, res);
+	else
+		job->ret = fixft_fix(s, res);
+	fixft_close(s);
+}
+
+static void *service_worker(void *arg)
+{
+	struct service *svc = arg;
+	struct svc_device *dev;
+	struct svc_job *job;
+	int again;
+
+	while ((dev = workq_pop(&svc->runq)) != NULL) {
+		pthread_mutex_lock(&svc->lock);
+		job = dev->head;
+		dev->head = job->next;
+		if (dev->head == NULL)
+			dev->tail = NULL;
+		pthread_mutex_unlock(&svc->lock);
+
+		service_run_job(svc, dev, job);
+
+		pthread_mutex_lock(&svc->lock);
+		svc->runs++;
+		if (job->res.status == FIX_FAILED)
+			svc->failed++;
+		printf("%-16s %-20s %-18s %6d %10.1f  %s\n", job->res.path,
+		       job->res.serial, fix_status_str(job->res.status),
+		       job->res.words_written, job->res.elapsed_ms,
+		       job->res.msg);
+		fflush(stdout);
+		if (svc->cfg->json)
+			fix_result_json(svc->cfg->json, &job->res);
+		metrics_record(svc->cfg->metrics, &job->res);
+		job->done = 1;
+		pthread_cond_broadcast(&svc->cond);
+		/* next job of this device, after this one only */
+		again = (dev->head != NULL);
+		if (!again)
+			dev->scheduled = 0;
+		pthread_mutex_unlock(&svc->lock);
+		if (again && workq_push(&svc->runq, dev) != 0) {
+			pthread_mutex_lock(&svc->lock);
+			dev->scheduled = 0;
+			pthread_mutex_unlock(&svc->lock);
+		}
+	}
+	return NULL;
+}
+
+/* queue a job for path, or join the same one still waiting in queue */
+static struct svc_job *service_submit(struct service *svc, const char *path,
+		int op, const char *image)
+{
+	struct svc_device *dev;
+	struct svc_job *job;
+	int schedule = 0;
+
+	pthread_mutex_lock(&svc->lock);
+	if (svc->stopped || (dev = service_device(svc, path)) == NULL) {
+		pthread_mutex_unlock(&svc->lock);
+		return NULL;
+	}
+	for (job = dev->head; job; job = job->next)
+		if (job->op == op && strcmp(job->image, image) == 0)
+			break;
+	if (job) {
+		svc->coalesced++;
+	} else {
+		if ((job = calloc(1, sizeof(*job))) == NULL) {
+			pthread_mutex_unlock(&svc->lock);
+			return NULL;
+		}
+		job->op = op;
+		snprintf(job->image, sizeof(job->image), "%s", image);
+		if (dev->tail)
+			dev->tail->next = job;
+		else
+			dev->head = job;
+		dev->tail = job;
+		if (!dev->scheduled)
+			schedule = dev->scheduled = 1;
+	}
+	job->waiters++;
+	pthread_mutex_unlock(&svc->lock);
+
+	if (schedule && workq_push(&svc->runq, dev) != 0) {
+		/* stopping: service_run() fails the queued jobs */
+		pthread_mutex_lock(&svc->lock);
+		dev->scheduled = 0;
+		pthread_mutex_unlock(&svc->lock);
+	}
+	return job;
+}
+
+/* selector to device path, NULL with an error message in err */
+static const char *service_select(struct service *svc, const char *sel,
+		char *buf, int len, const char **err)
+{
+	struct usb_devinfo info;
+	char index[PATH_MAX];
+	const char *index_file = NULL;
+	int idx;
+
+	if (strncmp(sel, "path=", 5) == 0) {
+		sel += 5;
+		if (svc->sim) {
+			if (strncmp(sel, "sim-", 4) != 0 ||
+			    (idx = atoi(sel + 4)) < 0 ||
+			    idx >= svc->sim->count) {
+				*err = "no such simulated board";
+				return NULL;
+			}
+			snprintf(buf, len, "%s", sel);
+			return buf;
+		}
+		if (devindex_by_path(sel, &info) != 0) {
+			*err = "no such device";
+			return NULL;
+		}
+	} else if (strncmp(sel, "serial=", 7) == 0 && svc->sim == NULL) {
+		if (svc->cfg->state_dir) {
+			snprintf(index, sizeof(index), "%s/" DEVINDEX_FILE,
+				 svc->cfg->state_dir);
+			index_file = index;
+		}
+		if (devindex_by_serial(index_file, sel + 7, svc->vendor_id,
+				       svc->product_id, &info) != 0) {
+			*err = "no such device";
+			return NULL;
+		}
+	} else {
+		*err = "invalid selector";
+		return NULL;
+	}
+	snprintf(buf, len, "%s", info.path);
+	return buf;
+}
+
+static void service_reply_error(FILE *fd, const char *err)
+{
+	fprintf(fd, "{\"status\":\"failed\",\"error\":\"%s\"}\n", err);
+	fflush(fd);
+}
+
+static void service_handle(struct service *svc, FILE *fd)
+{
+	char line[PATH_MAX + 128], op[16], sel[128], image[PATH_MAX];
+	char path[32];
+	const char *err = NULL;
+	struct svc_job *job;
+	struct fix_result res;
+	int nb, code;
+
+	if (fgets(line, sizeof(line), fd) == NULL)
+		return;
+	image[0] = '\0';
+	nb = sscanf(line, "%15s %127s %4095s", op, sel, image);
+	if (nb == 2 && strcmp(op, "audit") == 0) {
+		code = SVC_AUDIT;
+	} else if (nb == 2 && strcmp(op, "fix") == 0) {
+		code = SVC_FIX;
+	} else if (nb == 3 && strcmp(op, "flash") == 0) {
+		code = SVC_FLASH;
+	} else {
+		service_reply_error(fd, "invalid request");
+		return;
+	}
+	/* service cwd is not the client one */
+	if (code == SVC_FLASH && image[0] != '/') {
+		service_reply_error(fd, "image path must be absolute");
+		return;
+	}
+
+	if (service_select(svc, sel, path, sizeof(path), &err) == NULL) {
+		service_reply_error(fd, err);
+		return;
+	}
+	if ((job = service_submit(svc, path, code, image)) == NULL) {
+		service_reply_error(fd, "service stopped");
+		return;
+	}
+
+	pthread_mutex_lock(&svc->lock);
+	while (!job->done)
+		pthread_cond_wait(&svc->cond, &svc->lock);
+	res = job->res;
+	if (--job->waiters == 0)
+		free(job);
+	pthread_mutex_unlock(&svc->lock);
+
+	fix_result_json(fd, &res);
+}
+
+static void *service_client(void *arg)
+{
+	struct svc_client *c = arg;
+	struct service *svc = c->svc;
+	FILE *fd;
+
+	if ((fd = fdopen(c->fd, "r+")) != NULL) {
+		service_handle(svc, fd);
+		fclose(fd);
+	} else {
+		close(c->fd);
+	}
+	free(c);
+
+	pthread_mutex_lock(&svc->lock);
+	svc->clients--;
+	pthread_cond_broadcast(&svc->cond);
+	pthread_mutex_unlock(&svc->lock);
+	return NULL;
+}
+
+/* socket created with mode: it gives the right to write EEPROMs */
+static int service_listen(const char *sock_path, int mode)
+{
+	struct sockaddr_un addr;
+	mode_t mask;
+	int fd, ret;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(sock_path) >= sizeof(addr.sun_path)) {
+		printf("%s: socket path too long\n", sock_path);
+		return -1;
+	}
+	strcpy(addr.sun_path, sock_path);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		perror("socket");
+		return -1;
+	}
+	/* left by a previous run */
+	unlink(sock_path);
+	/* no window with default permissions: no worker thread yet */
+	mask = umask(~mode & 0777);
+	ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+	umask(mask);
+	if (ret != 0 || chmod(sock_path, mode) != 0 ||
+	    listen(fd, 64) != 0) {
+		printf("%s: %s\n", sock_path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* accept clients until stopped, one thread per client */
+static void service_accept(struct service *svc, int lfd)
+{
+	struct pollfd pfd = { .fd = lfd, .events = POLLIN };
+	struct timeval tv = { .tv_sec = 5 };
+	struct svc_client *c;
+	pthread_attr_t attr;
+	pthread_t thread;
+	int fd;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	while (!service_stop) {
+		if (poll(&pfd, 1, 500) <= 0)
+			continue;
+		if ((fd = accept(lfd, NULL, NULL)) < 0)
+			continue;
+		/* a silent client must not hold the service at stop */
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		if ((c = malloc(sizeof(*c))) == NULL) {
+			close(fd);
+			continue;
+		}
+		c->svc = svc;
+		c->fd = fd;
+		pthread_mutex_lock(&svc->lock);
+		svc->clients++;
+		pthread_mutex_unlock(&svc->lock);
+		if (pthread_create(&thread, &attr, service_client, c) != 0) {
+			close(fd);
+			free(c);
+			pthread_mutex_lock(&svc->lock);
+			svc->clients--;
+			pthread_mutex_unlock(&svc->lock);
+		}
+	}
+	pthread_attr_destroy(&attr);
+}
+
+/* after workers are gone: jobs never run are answered as failed */
+static void service_flush(struct service *svc)
+{
+	struct svc_device *dev;
+	struct svc_job *job;
+
+	pthread_mutex_lock(&svc->lock);
+	svc->stopped = 1;
+	for (dev = svc->devices; dev; dev = dev->next) {
+		while ((job = dev->head) != NULL) {
+			dev->head = job->next;
+			job->res.status = FIX_FAILED;
+			snprintf(job->res.path, sizeof(job->res.path), "%s",
+				 dev->path);
+			snprintf(job->res.msg, sizeof(job->res.msg),
+				 "service stopped");
+			job->done = 1;
+		}
+		dev->tail = NULL;
+	}
+	pthread_cond_broadcast(&svc->cond);
+	while (svc->clients > 0)
+		pthread_cond_wait(&svc->cond, &svc->lock);
+	pthread_mutex_unlock(&svc->lock);
+
+	while ((dev = svc->devices) != NULL) {
+		svc->devices = dev->next;
+		free(dev);
+	}
+}
+
+int service_run(const char *sock_path, int sock_mode, int vendor_id,
+		int product_id, const struct sim_config *sim, int jobs,
+		const struct fix_config *cfg)
+{
+	struct service svc;
+	struct sigaction sa;
+	pthread_t *threads;
+	int lfd, ret = -1, i;
+
+	memset(&svc, 0, sizeof(svc));
+	svc.sim = sim;
+	svc.cfg = cfg;
+	svc.vendor_id = vendor_id;
+	svc.product_id = product_id;
+
+	if (sim == NULL && (svc.ctx = fixft_ctx_new()) == NULL)
+		return -1;
+	if (workq_init(&svc.runq) != 0) {
+		fixft_ctx_free(svc.ctx);
+		return -1;
+	}
+	pthread_mutex_init(&svc.lock, NULL);
+	pthread_cond_init(&svc.cond, NULL);
+
+	if (jobs < 1)
+		jobs = 1;
+	/* a libftdi context per worker, reused by all its jobs */
+	if (svc.ctx && fixft_ctx_reserve(svc.ctx, jobs) != 0) {
+		printf("can't allocate %d libftdi context(s)\n", jobs);
+		goto out;
+	}
+
+	if ((lfd = service_listen(sock_path, sock_mode)) < 0)
+		goto out;
+
+	threads = calloc(jobs, sizeof(pthread_t));
+	for (i = 0; threads && i < jobs; i++) {
+		if (pthread_create(&threads[i], NULL, service_worker,
+				   &svc) != 0)
+			break;
+	}
+	jobs = i;
+	if (jobs == 0) {
+		printf("no worker thread\n");
+		goto close;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = service_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	/* a client leaving early must not kill the service */
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("listening on %s (%d worker(s)), ^C to stop\n", sock_path,
+	       jobs);
+	printf("%-16s %-20s %-18s %6s %10s  %s\n", "path", "serial",
+	       "status", "words", "time(ms)", "error");
+	fflush(stdout);
+
+	service_accept(&svc, lfd);
+
+	workq_stop(&svc.runq);
+	for (i = 0; i < jobs; i++)
+		pthread_join(threads[i], NULL);
+	service_flush(&svc);
+	printf("%d run(s), %d failed, %d request(s) coalesced\n", svc.runs,
+	       svc.failed, svc.coalesced);
+	ret = svc.failed;
+close:
+	free(threads);
+	close(lfd);
+	unlink(sock_path);
+out:
+	pthread_cond_destroy(&svc.cond);
+	pthread_mutex_destroy(&svc.lock);
+	/* devices still queued are owned by svc.devices */
+	workq_destroy(&svc.runq, NULL);
+	fixft_ctx_free(svc.ctx);
+	return ret;
+}
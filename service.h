@@ -0,0 +1,21 @@
+#ifndef SERVICE_H_
+#define SERVICE_H_
+#include "fix.h"
+
+struct sim_config;
+
+/* provisioning service: serve requests from a UNIX socket until
+ * SIGINT/SIGTERM. one request per connection, one text line:
+ *	audit|fix path=<usb path>|serial=<serial>
+ *	flash path=<usb path>|serial=<serial> <absolute image file path>
+ * answered by the JSON record of the run (see fix_result_json()).
+ * requests are queued per device and run by jobs workers, a request
+ * equal to one still queued for the same device shares its run.
+ * with sim, path=sim-N selects simulated board N.
+ * the socket is created with sock_mode permissions (ie. 0600)
+ * return number of failed runs or -1 when the service can't start
+ */
+int service_run(const char *sock_path, int sock_mode, int vendor_id,
+		int product_id, const struct sim_config *sim, int jobs,
+		const struct fix_config *cfg);
+#endif
@@ -0,0 +1,396 @@
+/* sim.c
+ * simulated FT2232H for hardware-free runs and benchmarks
+ *
+ * (C) 2015-2019 by Gwenhael Goavec-Merou <gwen@trabucayre.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ftdi.h>
+#include "ftdi_i.h"
+#include "myftdi.h"
+#include "transport.h"
+#include "sim.h"
+
+struct sim_board {
+	const struct sim_config *cfg;
+	unsigned char mem[FTDI_MAX_EEPROM_SIZE];
+	int mem_size;		/* physical EEPROM size in bytes */
+	char file[256];		/* backing file, empty when in memory only */
+	int dirty;
+	unsigned int rand_state;
+};
+
+/* image name is used as a printf format: only "%%" and a single "%d" */
+static int sim_image_check(const char *image)
+{
+	const char *p;
+	int nb_index = 0;
+
+	for (p = strchr(image, '%'); p; p = strchr(p + 2, '%')) {
+		if (p[1] == 'd')
+			nb_index++;
+		else if (p[1] != '%')
+			return -1;
+	}
+	return nb_index > 1 ? -1 : 0;
+}
+
+int sim_parse(struct sim_config *cfg, const char *spec)
+{
+	char buf[256], *tok, *save, *val;
+
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->count = 1;
+	cfg->chip = 0x56;
+	cfg->seed = 1;
+
+	snprintf(buf, sizeof(buf), "%s", spec);
+	for (tok = strtok_r(buf, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		val = strchr(tok, '=');
+		if (val == NULL) {
+			cfg->count = atoi(tok);
+			continue;
+		}
+		*val++ = '\0';
+		if (!strcmp(tok, "count"))
+			cfg->count = atoi(val);
+		else if (!strcmp(tok, "chip"))
+			cfg->chip = strtol(val, NULL, 16);
+		else if (!strcmp(tok, "image"))
+			/* spec lifetime is the whole run (argv) */
+			cfg->image = spec + (val - buf);
+		else if (!strcmp(tok, "latency"))
+			cfg->latency_us = atoi(val);
+		else if (!strcmp(tok, "prog"))
+			cfg->prog_us = atoi(val);
+		else if (!strcmp(tok, "fail"))
+			cfg->fail_rate = atof(val);
+		else if (!strcmp(tok, "wfail"))
+			cfg->wfail_rate = atof(val);
+		else if (!strcmp(tok, "seed"))
+			cfg->seed = strtoul(val, NULL, 0);
+		else {
+			printf("unknown simulation parameter %s\n", tok);
+			return -1;
+		}
+	}
+
+	if (cfg->image && strchr(cfg->image, ',')) {
+		printf("simulation image must be the last parameter\n");
+		return -1;
+	}
+	if (cfg->image && sim_image_check(cfg->image) != 0) {
+		printf("simulation image: only one %%d conversion allowed\n");
+		return -1;
+	}
+	if (cfg->count < 1 || (cfg->chip != 0x46 && cfg->chip != 0x56 &&
+			       cfg->chip != 0x66)) {
+		printf("invalid simulation parameters\n");
+		return -1;
+	}
+	return 0;
+}
+
+static void sim_delay(long us)
+{
+	struct timespec ts;
+
+	if (us <= 0)
+		return;
+	ts.tv_sec = us / 1000000;
+	ts.tv_nsec = (us % 1000000) * 1000;
+	nanosleep(&ts, NULL);
+}
+
+/* one transfer: return 0 when it goes through, -1 on injected failure */
+static int sim_transfer(struct fix_dev *dev)
+{
+	struct sim_board *b = dev->priv;
+
+	dev->stats.transfers++;
+	if (b->cfg->fail_rate <= 0)
+		return 0;
+	if ((double)rand_r(&b->rand_state) / RAND_MAX >= b->cfg->fail_rate)
+		return 0;
+	dev->stats.failures++;
+	return -1;
+}
+
+/* time spent by nb transfers with up to window of them in flight */
+static long sim_transfers_time(struct sim_board *b, int nb, int window)
+{
+	if (window <= 1)
+		window = 1;
+	return (long)b->cfg->latency_us * ((nb + window - 1) / window);
+}
+
+/* read words [first, last[ into eeprom->buf */
+static int sim_read_words(struct fix_dev *dev, int first, int last,
+		int window)
+{
+	struct sim_board *b = dev->priv;
+	struct ftdi_context *ftdi = dev->ftdi;
+	int i, mem_words = b->mem_size / 2;
+
+	sim_delay(sim_transfers_time(b, last - first, window));
+	for (i = first; i < last; i++) {
+		if (sim_transfer(dev) != 0)
+			ftdi_error_return(-1, "reading eeprom failed");
+		/* address bits above EEPROM size are ignored: 93C46 wraps */
+		memcpy(ftdi->eeprom->buf + i * 2, b->mem + (i % mem_words) * 2,
+		       2);
+	}
+	return 0;
+}
+
+static int sim_read_word(struct fix_dev *dev, int addr, unsigned short *val);
+
+/* same sequence as my_ftdi_read_eeprom_async(): lower half, size probe,
+ * upper half only for a 256 bytes EEPROM
+ */
+static int sim_read_eeprom(struct fix_dev *dev, int window)
+{
+	struct ftdi_context *ftdi = dev->ftdi;
+	unsigned short probe[MY_FTDI_PROBE_WORDS];
+	int i, addr = -1, half = 0x80 / 2;
+
+	if (sim_read_words(dev, 0, half, window) != 0)
+		return -1;
+	for (i = 0; i < MY_FTDI_PROBE_WORDS; i++) {
+		if ((addr = my_ftdi_eeprom_probe_addr(ftdi, i)) < 0)
+			break;
+		if (sim_read_word(dev, addr, &probe[i]) != 0)
+			break;
+	}
+	if (my_ftdi_eeprom_probe_size(ftdi,
+			(addr < 0 || i == MY_FTDI_PROBE_WORDS) ? probe : NULL) > 0)
+		return 0;
+
+	if (sim_read_words(dev, half, FTDI_MAX_EEPROM_SIZE / 2, window) != 0)
+		return -1;
+	my_ftdi_eeprom_guess_size(ftdi);
+	return 0;
+}
+
+static int sim_read_word(struct fix_dev *dev, int addr, unsigned short *val)
+{
+	struct sim_board *b = dev->priv;
+	struct ftdi_context *ftdi = dev->ftdi;
+
+	sim_delay(b->cfg->latency_us);
+	if (sim_transfer(dev) != 0)
+		ftdi_error_return(-1, "reading eeprom failed");
+	addr %= b->mem_size / 2;
+	*val = b->mem[addr * 2] | (b->mem[addr * 2 + 1] << 8);
+	return 0;
+}
+
+static int sim_write_eeprom(struct fix_dev *dev, const unsigned char *orig,
+		int window, int delay_us, int retries)
+{
+	struct sim_board *b = dev->priv;
+	struct ftdi_context *ftdi = dev->ftdi;
+	unsigned char *image = ftdi->eeprom->buf;
+	unsigned char todo[FTDI_MAX_EEPROM_SIZE / 2];
+	int i, addr, pass, nb_changed, nb_todo, nb_failed = 0;
+	int prog_us = (b->cfg->prog_us > delay_us) ? b->cfg->prog_us : delay_us;
+
+	if (ftdi->eeprom->initialized_for_connected_device == 0)
+		ftdi_error_return(-3, "EEPROM not initialized for the connected device");
+
+	nb_changed = my_ftdi_eeprom_diff(ftdi, orig, todo);
+	if (nb_changed == 0)
+		return 0;
+
+	/* reset, modem status and latency requests sent before writing */
+	sim_delay(3L * b->cfg->latency_us);
+	dev->stats.transfers += 3;
+
+	/* blocking path stops on first failure, like the USB one */
+	if (window <= 1)
+		retries = 0;
+
+	for (pass = 0, nb_todo = nb_changed; pass <= retries && nb_todo;
+	     pass++) {
+		/* a write and a read back per word */
+		sim_delay(sim_transfers_time(b, 2 * nb_todo, window) +
+			  (long)nb_todo * prog_us);
+		nb_failed = 0;
+		if (pass > 0)
+			dev->stats.retries += 2 * nb_todo;
+		for (i = 0; i < FTDI_MAX_EEPROM_SIZE / 2; i++) {
+			if (!todo[i])
+				continue;
+			addr = i % (b->mem_size / 2);
+			if (sim_transfer(dev) == 0 &&
+			    (double)rand_r(&b->rand_state) / RAND_MAX >=
+			    b->cfg->wfail_rate) {
+				b->mem[addr * 2] = image[i * 2];
+				b->mem[addr * 2 + 1] = image[i * 2 + 1];
+				b->dirty = 1;
+			} else if (window <= 1) {
+				ftdi_error_return(-1, "unable to write eeprom");
+			}
+			if (sim_transfer(dev) != 0 ||
+			    b->mem[addr * 2] != image[i * 2] ||
+			    b->mem[addr * 2 + 1] != image[i * 2 + 1]) {
+				if (window <= 1)
+					ftdi_error_return(-5, "eeprom read back mismatch");
+				nb_failed++;
+				continue;
+			}
+			todo[i] = 0;
+		}
+		nb_todo = nb_failed;
+	}
+
+	if (nb_failed)
+		ftdi_error_return(-5, "eeprom read back mismatch");
+	return nb_changed;
+}
+
+static void sim_save(struct sim_board *b)
+{
+	FILE *fd;
+
+	if (!b->dirty || b->file[0] == '\0')
+		return;
+	if ((fd = fopen(b->file, "wb")) == NULL) {
+		printf("%s: can't save simulated EEPROM\n", b->file);
+		return;
+	}
+	fwrite(b->mem, 1, b->mem_size, fd);
+	fclose(fd);
+	b->dirty = 0;
+}
+
+static int sim_reset(struct fix_dev *dev)
+{
+	struct sim_board *b = dev->priv;
+
+	sim_delay(b->cfg->latency_us);
+	dev->stats.transfers++;
+	sim_save(b);
+	return 0;
+}
+
+static int sim_close(struct fix_dev *dev)
+{
+	struct sim_board *b = dev->priv;
+
+	sim_save(b);
+	free(b);
+	dev->priv = NULL;
+	return 0;
+}
+
+static const struct fix_transport_ops sim_ops = {
+	.name = "sim",
+	.read_eeprom = sim_read_eeprom,
+	.read_word = sim_read_word,
+	.write_eeprom = sim_write_eeprom,
+	.reset = sim_reset,
+	.close = sim_close,
+};
+
+/* factory content of an ECP5 EVN board: interface B as FIFO */
+static int sim_default_image(struct sim_board *b, struct ftdi_context *ftdi,
+		int index)
+{
+	char serial[16];
+
+	snprintf(serial, sizeof(serial), "SIM%04d", index);
+	if (ftdi_eeprom_initdefaults(ftdi, "Lattice",
+				     "Lattice ECP5 Evaluation Board",
+				     serial) != 0)
+		return -1;
+	ftdi->eeprom->chip = b->cfg->chip;
+	ftdi->eeprom->size = b->mem_size;
+	ftdi_set_eeprom_value(ftdi, CHANNEL_A_TYPE, CHANNEL_IS_FIFO);
+	ftdi_set_eeprom_value(ftdi, CHANNEL_B_TYPE, CHANNEL_IS_FIFO);
+	ftdi_set_eeprom_value(ftdi, CHANNEL_B_DRIVER, 0);
+	if (my_ftdi_eeprom_build(ftdi) < 0)
+		return -1;
+	memcpy(b->mem, ftdi->eeprom->buf, b->mem_size);
+	return 0;
+}
+
+static int sim_load_image(struct sim_board *b, int index)
+{
+	char name[256];
+	FILE *fd;
+	int size;
+
+	snprintf(name, sizeof(name), b->cfg->image, index);
+	if ((fd = fopen(name, "rb")) == NULL) {
+		printf("%s: can't open simulated EEPROM image\n", name);
+		return -1;
+	}
+	size = fread(b->mem, 1, b->mem_size, fd);
+	fclose(fd);
+	if (size != b->mem_size) {
+		printf("%s: image size %d, expected %d\n", name, size,
+		       b->mem_size);
+		return -1;
+	}
+	/* per board file: keep it updated */
+	if (strstr(b->cfg->image, "%d"))
+		snprintf(b->file, sizeof(b->file), "%s", name);
+	return 0;
+}
+
+int sim_dev_open(struct fix_dev *dev, const struct sim_config *cfg,
+		int index)
+{
+	struct sim_board *b;
+	int ret;
+
+	memset(dev, 0, sizeof(*dev));
+	dev->ops = &sim_ops;
+	snprintf(dev->path, sizeof(dev->path), "sim-%d", index);
+
+	if ((dev->ftdi = ftdi_new()) == NULL) {
+		printf("FTDI context allocation failed\n");
+		return -1;
+	}
+	dev->ftdi->type = TYPE_2232H;
+
+	if ((b = calloc(1, sizeof(struct sim_board))) == NULL)
+		goto err;
+	b->cfg = cfg;
+	b->mem_size = (cfg->chip == 0x46) ? 0x80 : 0x100;
+	b->rand_state = cfg->seed + index;
+	dev->priv = b;
+
+	if (cfg->image)
+		ret = sim_load_image(b, index);
+	else
+		ret = sim_default_image(b, dev->ftdi, index);
+	if (ret != 0)
+		goto err;
+
+	/* like after ftdi_usb_open(): nothing built for this device yet */
+	dev->ftdi->eeprom->initialized_for_connected_device = 0;
+	return 0;
+err:
+	free(dev->priv);
+	dev->priv = NULL;
+	ftdi_free(dev->ftdi);
+	dev->ftdi = NULL;
+	return -1;
+}
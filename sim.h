@@ -0,0 +1,24 @@
+#ifndef SIM_H_
+#define SIM_H_
+#include "transport.h"
+
+/* software FT2232H with a 93Cx6 EEPROM */
+struct sim_config {
+	int count;		/* number of simulated boards */
+	int chip;		/* 0x46 (128 bytes), 0x56 or 0x66 (256 bytes) */
+	const char *image;	/* initial content, "%d" for a file per board */
+	int latency_us;		/* per control transfer round-trip */
+	int prog_us;		/* per word programming time */
+	double fail_rate;	/* probability for a transfer to fail */
+	double wfail_rate;	/* probability for a word write to be lost */
+	unsigned int seed;
+};
+
+/* parse "count[,key=value...]" with keys count, chip, image, latency,
+ * prog, fail, wfail and seed. return 0 on success
+ */
+int sim_parse(struct sim_config *cfg, const char *spec);
+/* open simulated board index (0 .. count-1) */
+int sim_dev_open(struct fix_dev *dev, const struct sim_config *cfg,
+		int index);
+#endif
@@ -0,0 +1,54 @@
+#ifndef TRANSPORT_H_
+#define TRANSPORT_H_
+#include <ftdi.h>
+#include "myftdi.h"
+
+struct fix_dev;
+
+/* device access used by the fix flow: real USB device or simulated one */
+struct fix_transport_ops {
+	const char *name;
+	/* fill ftdi->eeprom->buf and guess eeprom->size */
+	int (*read_eeprom)(struct fix_dev *dev, int window);
+	int (*read_word)(struct fix_dev *dev, int addr, unsigned short *val);
+	/* write and read back words of ftdi->eeprom->buf which differ from
+	 * orig, return number of words written or < 0 on error
+	 */
+	int (*write_eeprom)(struct fix_dev *dev, const unsigned char *orig,
+			int window, int delay_us, int retries);
+	int (*reset)(struct fix_dev *dev);
+	int (*close)(struct fix_dev *dev);
+};
+
+/* one opened device: libftdi context used to decode/build EEPROM and
+ * the transport used to reach the device
+ */
+struct fix_dev {
+	struct ftdi_context *ftdi;
+	const struct fix_transport_ops *ops;
+	void *priv;
+	char path[32];
+	struct my_ftdi_stats stats;	/* transfers since open */
+	int keep_ftdi;		/* ftdi owned by the caller, not freed on close */
+};
+
+/* USB transport (transport_usb.c)
+ * passive: only open the libusb handle, kernel driver stays attached and
+ * no interface is claimed (EEPROM access uses endpoint 0 only)
+ */
+int usb_dev_open(struct fix_dev *dev, int vendor_id, int product_id,
+		int passive);
+int usb_dev_open_bus_addr(struct fix_dev *dev, int bus, int addr,
+		int passive);
+/* open udev with an existing context, kept on close */
+int usb_dev_open_device(struct fix_dev *dev, struct ftdi_context *ftdi,
+		struct libusb_device *udev, int passive);
+
+/* ftdi context using ctx instead of its own libusb context, so many
+ * devices share one libusb context
+ */
+struct ftdi_context *usb_ftdi_new_shared(struct libusb_context *ctx);
+void usb_ftdi_free_shared(struct ftdi_context *ftdi);
+
+int fix_dev_close(struct fix_dev *dev);
+#endif
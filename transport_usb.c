@@ -0,0 +1,285 @@
+/* transport_usb.c
+ * fix_dev transport on top of libftdi/libusb
+ *
+ * (C) 2015-2019 by Gwenhael Goavec-Merou <gwen@trabucayre.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ftdi.h>
+#include <libusb.h>
+#include "ftdi_i.h"
+#include "myftdi.h"
+#include "fix.h"
+#include "transport.h"
+
+static int usb_read_eeprom(struct fix_dev *dev, int window)
+{
+	return my_ftdi_read_eeprom_async(dev->ftdi, window, &dev->stats);
+}
+
+static int usb_read_word(struct fix_dev *dev, int addr, unsigned short *val)
+{
+	int ret;
+
+	dev->stats.transfers++;
+	ret = ftdi_read_eeprom_location(dev->ftdi, addr, val);
+	if (ret != 0)
+		dev->stats.failures++;
+	return ret;
+}
+
+static int usb_write_eeprom(struct fix_dev *dev, const unsigned char *orig,
+		int window, int delay_us, int retries)
+{
+	return my_ftdi_write_eeprom_async(dev->ftdi, orig, window, delay_us,
+					  retries, &dev->stats);
+}
+
+static int usb_reset(struct fix_dev *dev)
+{
+	dev->stats.transfers++;
+	return libusb_reset_device(dev->ftdi->usb_dev);
+}
+
+static int usb_close(struct fix_dev *dev)
+{
+	return ftdi_usb_close(dev->ftdi);
+}
+
+/* nothing claimed: only drop the handle */
+static int usb_passive_close(struct fix_dev *dev)
+{
+	libusb_close(dev->ftdi->usb_dev);
+	dev->ftdi->usb_dev = NULL;
+	return 0;
+}
+
+static const struct fix_transport_ops usb_ops = {
+	.name = "usb",
+	.read_eeprom = usb_read_eeprom,
+	.read_word = usb_read_word,
+	.write_eeprom = usb_write_eeprom,
+	.reset = usb_reset,
+	.close = usb_close,
+};
+
+static const struct fix_transport_ops usb_passive_ops = {
+	.name = "usb-passive",
+	.read_eeprom = usb_read_eeprom,
+	.read_word = usb_read_word,
+	.write_eeprom = usb_write_eeprom,
+	.reset = usb_reset,
+	.close = usb_passive_close,
+};
+
+/* same guess as ftdi_usb_open_dev() */
+static enum ftdi_chip_type usb_chip_type(struct libusb_device_descriptor *desc)
+{
+	switch (desc->bcdDevice) {
+	case 0x400:
+		return TYPE_BM;
+	case 0x200:
+		return (desc->iSerialNumber == 0) ? TYPE_BM : TYPE_AM;
+	case 0x500:
+		return TYPE_2232C;
+	case 0x600:
+		return TYPE_R;
+	case 0x700:
+		return TYPE_2232H;
+	case 0x800:
+		return TYPE_4232H;
+	case 0x900:
+		return TYPE_232H;
+	case 0x1000:
+		return TYPE_230X;
+	default:
+		return TYPE_BM;
+	}
+}
+
+/* EEPROM requests are vendor requests to the device on endpoint 0, they
+ * need neither the interface nor ftdi_sio out of the way: only open the
+ * handle, don't detach, claim, reset or set baudrate like
+ * ftdi_usb_open_dev() does, so tty and JTAG sessions keep running
+ */
+static int usb_passive_open_dev(struct fix_dev *dev, libusb_device *udev)
+{
+	struct ftdi_context *ftdi = dev->ftdi;
+	struct libusb_device_descriptor desc;
+	libusb_device_handle *handle;
+
+	if (libusb_get_device_descriptor(udev, &desc) < 0)
+		ftdi_error_return(-9, "libusb_get_device_descriptor() failed");
+	if (libusb_open(udev, &handle) < 0)
+		ftdi_error_return(-4, "libusb_open() failed");
+	ftdi_set_usbdev(ftdi, handle);
+	ftdi->type = usb_chip_type(&desc);
+	dev->ops = &usb_passive_ops;
+	return 0;
+}
+
+static int usb_passive_open(struct fix_dev *dev, int vendor_id,
+		int product_id)
+{
+	struct ftdi_context *ftdi = dev->ftdi;
+	struct ftdi_device_list *devlist;
+	int ret;
+
+	ret = ftdi_usb_find_all(ftdi, &devlist, vendor_id, product_id);
+	if (ret < 0)
+		return ret;
+	if (ret == 0)
+		ftdi_error_return(-3, "device not found");
+	ret = usb_passive_open_dev(dev, devlist->dev);
+	ftdi_list_free(&devlist);
+	return ret;
+}
+
+static int usb_passive_open_bus_addr(struct fix_dev *dev, int bus, int addr)
+{
+	struct ftdi_context *ftdi = dev->ftdi;
+	libusb_device **devs;
+	ssize_t nb, i;
+	int ret = -3;
+
+	if ((nb = libusb_get_device_list(ftdi->usb_ctx, &devs)) < 0)
+		ftdi_error_return(-5, "libusb_get_device_list() failed");
+	for (i = 0; i < nb; i++) {
+		if (libusb_get_bus_number(devs[i]) == bus &&
+		    libusb_get_device_address(devs[i]) == addr) {
+			ret = usb_passive_open_dev(dev, devs[i]);
+			break;
+		}
+	}
+	libusb_free_device_list(devs, 1);
+	if (i == nb)
+		ftdi_error_return(-3, "device not found");
+	return ret;
+}
+
+static int usb_dev_init(struct fix_dev *dev)
+{
+	memset(dev, 0, sizeof(*dev));
+	dev->ops = &usb_ops;
+	if ((dev->ftdi = ftdi_new()) == NULL) {
+		printf("FTDI context allocation failed\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int usb_dev_opened(struct fix_dev *dev, int ret)
+{
+	if (ret != 0) {
+		printf("FTDI open failed: %s\n",
+		       ftdi_get_error_string(dev->ftdi));
+		if (!dev->keep_ftdi)
+			ftdi_free(dev->ftdi);
+		dev->ftdi = NULL;
+		return ret;
+	}
+	fix_usb_path(libusb_get_device(dev->ftdi->usb_dev), dev->path,
+		     sizeof(dev->path));
+	return 0;
+}
+
+int usb_dev_open(struct fix_dev *dev, int vendor_id, int product_id,
+		int passive)
+{
+	if (usb_dev_init(dev) != 0)
+		return -1;
+	if (passive)
+		return usb_dev_opened(dev, usb_passive_open(dev, vendor_id,
+							    product_id));
+	return usb_dev_opened(dev, ftdi_usb_open(dev->ftdi, vendor_id,
+						 product_id));
+}
+
+int usb_dev_open_bus_addr(struct fix_dev *dev, int bus, int addr,
+		int passive)
+{
+	if (usb_dev_init(dev) != 0)
+		return -1;
+	if (passive)
+		return usb_dev_opened(dev, usb_passive_open_bus_addr(dev, bus,
+								     addr));
+	return usb_dev_opened(dev, ftdi_usb_open_bus_addr(dev->ftdi, bus,
+							  addr));
+}
+
+int usb_dev_open_device(struct fix_dev *dev, struct ftdi_context *ftdi,
+		struct libusb_device *udev, int passive)
+{
+	memset(dev, 0, sizeof(*dev));
+	dev->ops = &usb_ops;
+	dev->ftdi = ftdi;
+	dev->keep_ftdi = 1;
+	/* nothing left from previous device */
+	ftdi->eeprom->initialized_for_connected_device = 0;
+	ftdi->eeprom->size = -1;
+	if (passive)
+		return usb_dev_opened(dev, usb_passive_open_dev(dev, udev));
+	return usb_dev_opened(dev, ftdi_usb_open_dev(ftdi, udev));
+}
+
+/* ftdi_init() always does a libusb_init(): same defaults, set by hand,
+ * so a board costs no libusb context setup and teardown
+ */
+struct ftdi_context *usb_ftdi_new_shared(struct libusb_context *ctx)
+{
+	struct ftdi_context *ftdi = calloc(1, sizeof(*ftdi));
+
+	if (ftdi == NULL)
+		return NULL;
+	if ((ftdi->eeprom = calloc(1, sizeof(struct ftdi_eeprom))) == NULL) {
+		free(ftdi);
+		return NULL;
+	}
+	ftdi->usb_ctx = ctx;
+	ftdi->usb_read_timeout = 5000;
+	ftdi->usb_write_timeout = 5000;
+	ftdi->type = TYPE_BM;
+	ftdi->baudrate = -1;
+	ftdi->writebuffer_chunksize = 4096;
+	ftdi->module_detach_mode = AUTO_DETACH_SIO_MODULE;
+	ftdi_set_interface(ftdi, INTERFACE_ANY);
+	ftdi->bitbang_mode = 1;
+	if (ftdi_read_data_set_chunksize(ftdi, 4096) != 0) {
+		usb_ftdi_free_shared(ftdi);
+		return NULL;
+	}
+	return ftdi;
+}
+
+void usb_ftdi_free_shared(struct ftdi_context *ftdi)
+{
+	/* ftdi_deinit() would libusb_exit() the shared context */
+	ftdi->usb_ctx = NULL;
+	ftdi_free(ftdi);
+}
+
+int fix_dev_close(struct fix_dev *dev)
+{
+	int ret;
+
+	if (dev->ftdi == NULL)
+		return 0;
+	ret = dev->ops->close(dev);
+	if (!dev->keep_ftdi)
+		ftdi_free(dev->ftdi);
+	dev->ftdi = NULL;
+	return ret;
+}
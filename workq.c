@@ -0,0 +1,111 @@
+/* workq.c
+ * minimal blocking work queue
+ *
+ * (C) 2015-2019 by Gwenhael Goavec-Merou <gwen@trabucayre.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+*/
+
+#include <stdlib.h>
+#include <pthread.h>
+#include "workq.h"
+
+struct workq_item {
+	struct workq_item *next;
+	void *data;
+};
+
+int workq_init(struct workq *q)
+{
+	q->head = q->tail = NULL;
+	q->len = 0;
+	q->stop = 0;
+	if (pthread_mutex_init(&q->lock, NULL) != 0)
+		return -1;
+	if (pthread_cond_init(&q->cond, NULL) != 0) {
+		pthread_mutex_destroy(&q->lock);
+		return -1;
+	}
+	return 0;
+}
+
+void workq_destroy(struct workq *q, void (*free_data)(void *))
+{
+	struct workq_item *item;
+
+	while ((item = q->head) != NULL) {
+		q->head = item->next;
+		if (free_data)
+			free_data(item->data);
+		free(item);
+	}
+	pthread_cond_destroy(&q->cond);
+	pthread_mutex_destroy(&q->lock);
+}
+
+int workq_push(struct workq *q, void *data)
+{
+	struct workq_item *item = malloc(sizeof(struct workq_item));
+
+	if (item == NULL)
+		return -1;
+	item->next = NULL;
+	item->data = data;
+
+	pthread_mutex_lock(&q->lock);
+	if (q->stop) {
+		pthread_mutex_unlock(&q->lock);
+		free(item);
+		return -1;
+	}
+	if (q->tail)
+		q->tail->next = item;
+	else
+		q->head = item;
+	q->tail = item;
+	q->len++;
+	pthread_cond_signal(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+	return 0;
+}
+
+void *workq_pop(struct workq *q)
+{
+	struct workq_item *item;
+	void *data;
+
+	pthread_mutex_lock(&q->lock);
+	while (q->head == NULL && !q->stop)
+		pthread_cond_wait(&q->cond, &q->lock);
+	if (q->stop) {
+		pthread_mutex_unlock(&q->lock);
+		return NULL;
+	}
+	item = q->head;
+	q->head = item->next;
+	if (q->head == NULL)
+		q->tail = NULL;
+	q->len--;
+	pthread_mutex_unlock(&q->lock);
+
+	data = item->data;
+	free(item);
+	return data;
+}
+
+void workq_stop(struct workq *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->stop = 1;
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+}
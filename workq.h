@@ -0,0 +1,26 @@
+#ifndef WORKQ_H_
+#define WORKQ_H_
+#include <pthread.h>
+
+struct workq_item;
+
+/* blocking FIFO shared between producers and a pool of workers */
+struct workq {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct workq_item *head;
+	struct workq_item *tail;
+	int len;
+	int stop;
+};
+
+int workq_init(struct workq *q);
+/* free_data, when set, is called on every item still queued */
+void workq_destroy(struct workq *q, void (*free_data)(void *));
+/* return 0 or -1 when allocation fails or queue is stopped */
+int workq_push(struct workq *q, void *data);
+/* wait for an item, NULL once the queue is stopped */
+void *workq_pop(struct workq *q);
+/* wake up all workers, next pops return NULL */
+void workq_stop(struct workq *q);
+#endif